@@ -6,54 +6,128 @@
 #include "minithread.h"
 #include "queue.h"
 
+//Fires the alarms, on the host thread that called alarm_initialize
+static timer_t alarmClock;
+
+//Tick alarmClock is set for, 0 if it is stopped
+static long alarmClockTick;
+
+/*
+ * Set alarmClock for the next alarm, or stop it if there is none. If the
+ * interrupt is dropped the clock retries every ALARM_RESOLUTION.
+ * Interrupts must be disabled.
+ */
+static void
+alarm_clock_program()
+{
+    long next = timerwheel_next(alarms);
+
+    alarmClockTick = next == -1 ? 0 : next;
+    minithread_alarm_clock_set(alarmClock, alarmClockTick * ALARM_RESOLUTION, ALARM_RESOLUTION);
+}
+
+/*
+ * The alarm clock's interrupt handler: fire the alarms that are due and
+ * set the clock for the next one.
+ */
+static void
+alarm_interrupt(void *arg)
+{
+    set_interrupt_level(DISABLED);
+    callAlarms(alarms, alarm_now() / ALARM_RESOLUTION);
+    alarm_clock_program();
+    set_interrupt_level(ENABLED);
+}
+
 /* see alarm.h */
-alarm_id
-register_alarm(int delay, alarm_handler_t alarm, void *arg)
+void
+alarm_initialize()
+{
+    alarms = timerwheel_new(alarm_now() / ALARM_RESOLUTION);
+    alarmClock = minithread_alarm_clock_init(alarm_interrupt);
+    alarmClockTick = 0;
+}
+
+/* see alarm.h */
+long
+alarm_now()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * (long) SECOND + now.tv_nsec;
+}
+
+/*
+ * Add an alarm to the wheel going off at deadline (nanoseconds) and every
+ * period nanoseconds after that if period is not 0, bringing the alarm
+ * clock forward if it is the earliest.
+ */
+static alarm_id
+alarm_add(long deadline, long period, alarm_handler_t alarm, void *arg)
 {
-    double d;
 	//Holder for last interrupt level
 	interrupt_level_t previousLevel;
-    listnode_t node;
-
-	//Disable interrupts
-	previousLevel = set_interrupt_level(DISABLED);
+	alarm_id id;
+	long tick;
 
 	//Check to make sure alarm != NULL
 	if (alarm == NULL)
 		return NULL;
 
+	//Disable interrupts
+	previousLevel = set_interrupt_level(DISABLED);
+
+	//Rounded up to a whole tick, so the alarm never goes off early
+	tick = (deadline + ALARM_RESOLUTION - 1) / ALARM_RESOLUTION;
+	id = (alarm_id) timerwheel_add_periodic(alarms, tick,
+		(period + ALARM_RESOLUTION - 1) / ALARM_RESOLUTION, alarm, arg);
+	if (id != NULL && (alarmClockTick == 0 || tick < alarmClockTick))
+		alarm_clock_program();
+
+	//Restore the previous interrupt level 
+	set_interrupt_level(previousLevel);
+
+	return id;
+}
+
+/* see alarm.h */
+alarm_id
+register_alarm(int delay, alarm_handler_t alarm, void *arg)
+{
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+
 	//If alarm supposed to go off NOW	
-	if(delay == 0) {
+	if(delay == 0 && alarm != NULL) {
+		previousLevel = set_interrupt_level(DISABLED);
 		alarm(arg);
+		set_interrupt_level(previousLevel);
 		return NULL;
 	}
-    node = (listnode_t) malloc(sizeof(listnode));        
-    node->time = currentTime + ((delay * MILLISECOND) / QUANTA);
-    d = (double) ((long) delay * (long) MILLISECOND);
-    node->time = (int) (d / (double) QUANTA);
-     
-    node->func = alarm;
-    node->arg = arg;
-    node->id = (void *) node;
-    insert(alarms, node);
 
-	//Restore the previous interrupt level 
-	set_interrupt_level(previousLevel);
+    return alarm_add(alarm_now() + (long) delay * MILLISECOND, 0, alarm, arg);
+}
 
-    return (alarm_id) node;
+/* see alarm.h */
+alarm_id
+register_alarm_at(long deadline, alarm_handler_t alarm, void *arg)
+{
+    return alarm_add(deadline, 0, alarm, arg);
 }
 
-void callAlarms(sortedlist_t list, int current) 
+/* see alarm.h */
+alarm_id
+register_periodic_alarm(int period, alarm_handler_t alarm, void *arg)
 {
-	listnode_t cur = list->head;
-	listnode_t tmp;
-	while (cur != NULL && cur->time < current)
-	{
-		cur->func(cur->arg);
-		tmp = cur;
-		cur = cur->next;
-		remove_node(list, tmp->id);
-	}
+    if (period <= 0)
+        return NULL;
+    return alarm_add(alarm_now() + (long) period * MILLISECOND, (long) period * MILLISECOND, alarm, arg);
+}
+
+void callAlarms(timerwheel_t wheel, long current) 
+{
+	timerwheel_advance(wheel, current);
 }
 	
 /* see alarm.h */
@@ -63,7 +137,7 @@ deregister_alarm(alarm_id alarm)
     int ret;
     interrupt_level_t previousLevel;
     previousLevel = set_interrupt_level(DISABLED);
-    ret = !(remove_node(alarms, alarm));
+    ret = !(timerwheel_cancel(alarms, (timer_id_t) alarm));
     set_interrupt_level(previousLevel);
     return ret;
 }
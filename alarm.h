@@ -1,6 +1,6 @@
 #ifndef __ALARM_H__
 #define __ALARM_H__ 1
-#include "sortedlist.h"
+#include "timerwheel.h"
 
 /*
  * This is the alarm interface. You should implement the functions for these
@@ -16,15 +16,44 @@ typedef void (*alarm_handler_t)(void*);
 typedef void *alarm_id;
 extern int currentTime;
 
+/* Alarms are kept on CLOCK_MONOTONIC, independent of the scheduler's
+ * quanta, and go off within ALARM_RESOLUTION nanoseconds of their
+ * deadline.  The alarms wheel counts time in ALARM_RESOLUTION ticks.
+ */
+#define ALARM_RESOLUTION 100000
+
+/* start the alarm clock.  Called once by minithread_system_initialize on
+ * the host thread alarms are to run on.
+ */
+void alarm_initialize();
+
+/* return the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+long alarm_now();
+
 /* register an alarm to go off in "delay" milliseconds.  Returns a handle to
  * the alarm.
  */
 alarm_id register_alarm(int delay, alarm_handler_t func, void *arg);
 
+/* register an alarm to go off once CLOCK_MONOTONIC reaches "deadline"
+ * nanoseconds (see alarm_now).  Returns a handle to the alarm.
+ */
+alarm_id register_alarm_at(long deadline, alarm_handler_t func, void *arg);
+
+/* register an alarm to go off every "period" milliseconds, the first time
+ * "period" milliseconds from now, until it is unregistered.  The handle
+ * stays the same throughout; the alarm may unregister itself.
+ */
+alarm_id register_periodic_alarm(int period, alarm_handler_t func, void *arg);
+
 /* unregister an alarm.  Returns 0 if the alarm had not been executed, 1
  * otherwise.
  */
 int deregister_alarm(alarm_id id);
 
-void callAlarms(sortedlist_t list, int curtime); 
+/* fire the alarms in wheel that are due at or before ALARM_RESOLUTION tick
+ * curtime.
+ */
+void callAlarms(timerwheel_t wheel, long curtime);
 #endif
@@ -4,36 +4,95 @@
 #include "alarm.h"
 
 int x;
+timerwheel_t wheel;
+timer_id_t victim;
 
 void func(void *arg)
 {
 	x++;
 }
 
+void cancel(void *arg)
+{
+	x++;
+	assert(timerwheel_cancel(wheel, victim) == 1);
+}
+
+void stop(void *arg)
+{
+	if (++x == 110)
+		assert(timerwheel_cancel(wheel, victim) == 1);
+}
+
 int
 main(int argc, char *argv[])
 {
-	sortedlist_t list = new_sortedlist();
-	listnode_t node;
+	timer_id_t ids[100];
+	timer_id_t stale;
 	int i;
-	int *arg;
 	x = 0;
+	wheel = timerwheel_new(0);
 	for (i = 99; i >= 0; i--)
-	{
-		node = (listnode_t) malloc(sizeof(listnode));
-		node->id = malloc(sizeof(short));
-		node->time = i;
-		arg = (int *) malloc(sizeof(int));	
-		*arg = i;
-		node->arg = arg;
-		node->func = func;
-		insert(list, node);
-	}	
-	callAlarms(list, 50);
+		ids[i] = timerwheel_add(wheel, i + 1, func, NULL);
+	assert(timerwheel_length(wheel) == 100);
+	assert(timerwheel_next(wheel) == 1);
+	callAlarms(wheel, 50);
 	assert(x == 50);
-	callAlarms(list, 50);
+	callAlarms(wheel, 50);
 	assert(x == 50);
-	callAlarms(list, 100);
+	assert(timerwheel_next(wheel) == 51);
+	callAlarms(wheel, 100);
 	assert(x == 100);
+	assert(timerwheel_length(wheel) == 0 && timerwheel_next(wheel) == -1);
+
+	//Fired alarms can not be cancelled, even once their timers are reused
+	stale = ids[0];
+	ids[0] = timerwheel_add(wheel, 110, func, NULL);
+	assert(timerwheel_cancel(wheel, stale) == 0);
+	assert(timerwheel_cancel(wheel, ids[0]) == 1);
+	assert(timerwheel_cancel(wheel, ids[0]) == 0);
+	callAlarms(wheel, 120);
+	assert(x == 100);
+
+	//Deadlines on the higher levels cascade down and fire on time
+	ids[0] = timerwheel_add(wheel, 100000, func, NULL);
+	ids[1] = timerwheel_add(wheel, 5000, func, NULL);
+	assert(timerwheel_next(wheel) <= 5000);
+	callAlarms(wheel, 4999);
+	assert(x == 100);
+	assert(timerwheel_next(wheel) == 5000);
+	callAlarms(wheel, 5000);
+	assert(x == 101);
+	callAlarms(wheel, 99999);
+	assert(x == 101);
+	callAlarms(wheel, 100000);
+	assert(x == 102);
+
+	//A firing alarm can cancel another due at the same time
+	timerwheel_add(wheel, 100010, cancel, NULL);
+	victim = timerwheel_add(wheel, 100010, func, NULL);
+	callAlarms(wheel, 100010);
+	assert(x == 103 && timerwheel_length(wheel) == 0);
+
+	//Deadlines already passed fire at the next tick
+	timerwheel_add(wheel, 5, func, NULL);
+	callAlarms(wheel, 100011);
+	assert(x == 104);
+
+	//Periodic alarms keep firing under the same id until cancelled,
+	//including from their own function
+	victim = timerwheel_add_periodic(wheel, 100020, 10, stop, NULL);
+	callAlarms(wheel, 100065);
+	assert(x == 109 && timerwheel_length(wheel) == 1);
+	callAlarms(wheel, 100200);
+	assert(x == 110 && timerwheel_length(wheel) == 0);
+	assert(timerwheel_cancel(wheel, victim) == 0);
+
+	//Deadlines beyond the wheel's span wait at its end, then fire on time
+	timerwheel_add(wheel, 100011 + (3L << 24), func, NULL);
+	callAlarms(wheel, 100010 + (3L << 24));
+	assert(x == 110);
+	callAlarms(wheel, 100011 + (3L << 24));
+	assert(x == 111);
 	return 0;
 }
@@ -1,129 +1,536 @@
 /*
- * Generic singly linked list implementation.
+ * Disk block cache: a hash table of blocks on an LRU list.
  *
  */
 #include "blockcache.h"
+#include "queue.h"
 #include <stdlib.h>
 #include <stdio.h>
 
-#define LIMIT 50
+//Lists a block can be on. Blocks on the ghost lists have been evicted:
+//only their numbers are kept, so the policy can tell when they come back
+enum {
+	RECENT, //LRU: every block. 2Q: A1in. ARC: T1
+	FREQUENT, //2Q: Am. ARC: T2
+	RECENT_GHOST, //2Q: A1out. ARC: B1
+	FREQUENT_GHOST, //ARC: B2
+	LISTS
+};
 
-//Items in the blockcache
-struct blockcacheNode { 
-	void* data;	//Pointer to item
-	int key;
-	struct blockcacheNode* next; //Next blockcacheNode in blockcache
+//Cached blocks
+struct blockcacheNode {
+	void* data;	//Pointer to block contents, NULL on a ghost list
+	int key; //Block number
+	int list; //Which of the blockcache's lists the block is on
+	int references; //Holders keeping the block from being evicted
+	int dirty; //Set while the data is newer than the disk
+	int unused; //Set from blockcache_prefetch until the block is first got
+	struct queue_link dirtyLink; //Place on the dirty list, while dirty
+	struct blockcacheNode* next; //Next blockcacheNode in the same hash bucket
+	struct queue_link lruLink; //Place on its list
 };
 
 //blockcache
-struct blockcache { 
-	int size; //Size of blockcache
-	struct blockcacheNode *front; //First blockcache in queue
+struct blockcache {
+	blockcache_policy_t policy;
+	int size; //Blocks in the blockcache, not counting ghosts
+	int capacity; //Most blocks the blockcache holds
+	int recentTarget; //ARC: blocks the RECENT list is aiming for
+	int bucketBits; //log2 of the number of hash buckets
+	struct blockcacheNode **buckets;
+	struct intrusive_queue lists[LISTS]; //Least recently used at the front
+	struct intrusive_queue dirty; //Dirty blocks, longest dirty at the front
+	long hits;
+	long misses;
+	long evictions;
 };
 
+
+//HELPER FUNCTIONS
+/*
+ * Return the bucket holding key. Multiplicative hashing, so that runs of
+ * block numbers and block numbers with a common stride both spread out.
+ */
+static blockcacheNode_t*
+blockcache_bucket(blockcache_t blockcache, int key)
+{
+	unsigned int hash = (unsigned int) key * 2654435761u;
+
+	return &blockcache->buckets[hash >> (32 - blockcache->bucketBits)];
+}
+
+/*
+ * Return the link pointing to the node for key, or to the NULL at the end
+ * of its bucket if key is neither cached nor a ghost.
+ */
+static blockcacheNode_t*
+blockcache_find(blockcache_t blockcache, int key)
+{
+	blockcacheNode_t *nodePtr = blockcache_bucket(blockcache, key);
+
+	while (*nodePtr != NULL && (*nodePtr)->key != key)
+		nodePtr = &(*nodePtr)->next;
+	return nodePtr;
+}
+
+/*
+ * Return the node for key if it is cached, or NULL if it is not, or only
+ * a ghost.
+ */
+static blockcacheNode_t
+blockcache_lookup(blockcache_t blockcache, int key)
+{
+	blockcacheNode_t node = *blockcache_find(blockcache, key);
+
+	if (node == NULL || node->list >= RECENT_GHOST)
+		return NULL;
+	return node;
+}
+
+/*
+ * Move node to the most recently used end of list.
+ */
+static void
+blockcache_move(blockcache_t blockcache, blockcacheNode_t node, int list)
+{
+	intrusive_queue_delete(&blockcache->lists[node->list], &node->lruLink);
+	node->list = list;
+	intrusive_queue_append(&blockcache->lists[list], &node->lruLink);
+}
+
 /*
- * Return an empty blockcache.
- * blockcache will be size 0.
+ * Return the number of blocks, or ghosts, on list.
  */
-blockcache_t blockcache_new() 
+static int
+blockcache_list_length(blockcache_t blockcache, int list)
 {
-	blockcache_t blockcache = (blockcache_t) malloc(sizeof(struct blockcache));
-    
-    //Makes sure blockcache was made sucessfully
-    if (blockcache == NULL)
-    	return NULL;
-    //else
-    blockcache->size = 0;
-    blockcache->front = NULL;
+	return intrusive_queue_length(&blockcache->lists[list]);
+}
 
-    return (blockcache_t) blockcache;
+/*
+ * Take node, cached or a ghost, out of the blockcache and free it,
+ * returning its data.
+ */
+static void*
+blockcache_unlink(blockcache_t blockcache, blockcacheNode_t node)
+{
+	blockcacheNode_t *nodePtr = blockcache_find(blockcache, node->key);
+	void *data = node->data;
+
+	*nodePtr = node->next;
+	intrusive_queue_delete(&blockcache->lists[node->list], &node->lruLink);
+	if (node->dirty)
+		intrusive_queue_delete(&blockcache->dirty, &node->dirtyLink);
+	if (node->list < RECENT_GHOST)
+		blockcache->size--;
+	free(node);
+	return data;
 }
 
 /*
- * Prepend a void* to a blockcache (both specifed as parameters). Return
- * 0 (success) or -1 (failure).
+ * Forget the least recently evicted ghosts of list until it has at most
+ * length.
  */
-int blockcache_insert(blockcache_t blockcache, int key, void* item) 
+static void
+blockcache_trim_ghosts(blockcache_t blockcache, int list, int length)
 {
-	blockcacheNode_t listNode = (blockcacheNode_t) malloc(sizeof(struct blockcacheNode));
+	while (blockcache_list_length(blockcache, list) > length)
+		blockcache_unlink(blockcache, queue_entry(blockcache->lists[list].front,
+			struct blockcacheNode, lruLink));
+}
 
-	//Check that blockcache and item exists and that listNode was properly created
-	if (blockcache != NULL && item != NULL && listNode != NULL) 
+/*
+ * Keep the ghost lists to their bounds: for 2Q, half the capacity; for
+ * ARC, T1 and B1 together at most the capacity, and all four lists at
+ * most twice that.
+ */
+static void
+blockcache_bound_ghosts(blockcache_t blockcache)
+{
+	int recent = blockcache_list_length(blockcache, RECENT);
+	int ghosts;
+
+	if (blockcache->policy == BLOCKCACHE_2Q)
+		blockcache_trim_ghosts(blockcache, RECENT_GHOST, blockcache->capacity / 2);
+	else if (blockcache->policy == BLOCKCACHE_ARC)
 	{
-		listNode->data = item;
-		listNode->key = key;
-		listNode->next = blockcache->front;
+		blockcache_trim_ghosts(blockcache, RECENT_GHOST,
+			recent < blockcache->capacity ? blockcache->capacity - recent : 0);
+		ghosts = 2 * blockcache->capacity - blockcache->size -
+			blockcache_list_length(blockcache, RECENT_GHOST);
+		blockcache_trim_ghosts(blockcache, FREQUENT_GHOST, ghosts > 0 ? ghosts : 0);
+	}
+}
 
-		blockcache->front = listNode;
+/*
+ * Return the least recently used node on list that is neither held nor
+ * dirty, or NULL if there is none. Only those blocks are passed over, so
+ * this is quick unless most of the list is in use or waiting to be
+ * written.
+ */
+static blockcacheNode_t
+blockcache_oldest(blockcache_t blockcache, int list)
+{
+	queue_link_t link;
+	blockcacheNode_t node;
 
-		//Reflect that blockcache grew in size
-		blockcache->size++;
+	for (link = blockcache->lists[list].front; link != NULL; link = link->next)
+	{
+		node = queue_entry(link, struct blockcacheNode, lruLink);
+		if (node->references == 0 && !node->dirty)
+			return node;
+	}
+	return NULL;
+}
 
-		if (blockcache->size > LIMIT)
-		{
-			blockcache_delete_last(blockcache);
-		}
-		return 0;
+/*
+ * Return the block the policy would evict next, or NULL if every block is
+ * held or dirty. 2Q evicts from A1in once it is over a quarter of the
+ * capacity, and ARC from T1 once it is over its adaptive target; otherwise
+ * both evict from the other list, and either falls back on the other list
+ * if it has nothing to evict.
+ */
+static blockcacheNode_t
+blockcache_victim(blockcache_t blockcache)
+{
+	int recent = blockcache_list_length(blockcache, RECENT);
+	int first = FREQUENT;
+	blockcacheNode_t node;
+
+	if (blockcache->policy == BLOCKCACHE_LRU)
+		first = RECENT;
+	else if (blockcache->policy == BLOCKCACHE_2Q && recent > blockcache->capacity / 4)
+		first = RECENT;
+	else if (blockcache->policy == BLOCKCACHE_ARC && recent > blockcache->recentTarget)
+		first = RECENT;
+
+	node = blockcache_oldest(blockcache, first);
+	if (node == NULL && blockcache->policy != BLOCKCACHE_LRU)
+		node = blockcache_oldest(blockcache, first == RECENT ? FREQUENT : RECENT);
+	return node;
+}
+
+/*
+ * Move node, just used, where the policy keeps recently used blocks.
+ */
+static void
+blockcache_touch(blockcache_t blockcache, blockcacheNode_t node)
+{
+	//A block read ahead is being used for the first time
+	if (node->unused)
+	{
+		node->unused = 0;
+		if (blockcache->policy != BLOCKCACHE_2Q)
+			blockcache_move(blockcache, node, RECENT);
+		return;
 	}
-	//else 
-	return -1;
+	if (blockcache->policy == BLOCKCACHE_LRU)
+	{
+		blockcache_move(blockcache, node, RECENT);
+		return;
+	}
+	//A block used again before anything else was, as a scan does reading
+	//a block a piece at a time, has not been used more than once yet. 2Q
+	//goes further and leaves every block in A1in where it is
+	if (node->list == RECENT && (blockcache->policy == BLOCKCACHE_2Q ||
+		blockcache->lists[RECENT].rear == &node->lruLink))
+		return;
+	blockcache_move(blockcache, node, FREQUENT);
 }
 
 /*
- * Dequeue and return the first void* from the blockcache or NULL if blockcache
- * is empty.  Return 0 (success) or -1 (failure).
+ * ARC: a block evicted from list was wanted again, so that list was short
+ * of room. Move the RECENT list's target towards it, by more the rarer
+ * such ghosts are.
  */
-int blockcache_dequeue(blockcache_t blockcache, void** item) 
+static void
+blockcache_adapt(blockcache_t blockcache, int list)
 {
-	blockcacheNode_t frontNode;
+	int recentGhosts = blockcache_list_length(blockcache, RECENT_GHOST);
+	int frequentGhosts = blockcache_list_length(blockcache, FREQUENT_GHOST);
+
+	if (list == RECENT_GHOST)
+		blockcache->recentTarget += frequentGhosts > recentGhosts ? frequentGhosts / recentGhosts : 1;
+	else
+		blockcache->recentTarget -= recentGhosts > frequentGhosts ? recentGhosts / frequentGhosts : 1;
+	if (blockcache->recentTarget > blockcache->capacity)
+		blockcache->recentTarget = blockcache->capacity;
+	if (blockcache->recentTarget < 0)
+		blockcache->recentTarget = 0;
+}
+
+/*
+ * Evict down to capacity, if blocks that could not be evicted when others
+ * were added have since been released or cleaned.
+ */
+static void
+blockcache_shrink(blockcache_t blockcache)
+{
+	while (blockcache->size > blockcache->capacity && blockcache_victim(blockcache) != NULL)
+		blockcache_delete_last(blockcache);
+}
+
+
+//REQUIRED FUNCTIONS
+/*
+ * Return an empty blockcache of the default capacity.
+ */
+blockcache_t blockcache_new()
+{
+	return blockcache_create(BLOCKCACHE_DEFAULT_CAPACITY);
+}
 
-	//Check that blockcache and item exists
-	if (blockcache != NULL && item != NULL) 
+blockcache_t blockcache_create(int capacity)
+{
+	return blockcache_create_policy(capacity, BLOCKCACHE_LRU);
+}
+
+blockcache_t blockcache_create_policy(int capacity, blockcache_policy_t policy)
+{
+	blockcache_t blockcache;
+	int bits = 1;
+	int list;
+
+	if (capacity <= 0 || policy < BLOCKCACHE_LRU || policy > BLOCKCACHE_ARC)
+		return NULL;
+
+	blockcache = (blockcache_t) malloc(sizeof(struct blockcache));
+	//Makes sure blockcache was made sucessfully
+	if (blockcache == NULL)
+		return NULL;
+
+	//At least as many buckets as blocks, ghosts included, so chains stay short
+	while (bits < 30 && (1 << bits) < (policy == BLOCKCACHE_LRU ? capacity : 2 * capacity))
+		bits++;
+	blockcache->buckets = (blockcacheNode_t*) calloc(1 << bits, sizeof(blockcacheNode_t));
+	if (blockcache->buckets == NULL)
 	{
-		frontNode = blockcache->front;
-		if (frontNode != NULL)
-		{
-			*item = blockcache->front->data;
+		free(blockcache);
+		return NULL;
+	}
+	blockcache->policy = policy;
+	blockcache->bucketBits = bits;
+	blockcache->size = 0;
+	blockcache->capacity = capacity;
+	blockcache->recentTarget = 0;
+	for (list = 0; list < LISTS; list++)
+		intrusive_queue_init(&blockcache->lists[list]);
+	intrusive_queue_init(&blockcache->dirty);
+	blockcache->hits = 0;
+	blockcache->misses = 0;
+	blockcache->evictions = 0;
+
+	return blockcache;
+}
 
-			//Reassign front
-			blockcache->front = blockcache->front->next;
-						
-			free(frontNode);
-			
-			//Reflect that blockcache shrunk in size
-			blockcache->size--;
+blockcache_t blockcache_create_bytes(long bytes, int blockSize)
+{
+	if (blockSize <= 0)
+		return NULL;
+	if (bytes < blockSize)
+		return blockcache_create(1);
+	return blockcache_create((int) (bytes / blockSize));
+}
+
+/*
+ * Cache item as block key, as blockcache_insert or blockcache_prefetch.
+ * Return 0 (success) or -1 (failure).
+ */
+static int
+blockcache_add(blockcache_t blockcache, int key, void* item, int unused)
+{
+	blockcacheNode_t *nodePtr;
+	blockcacheNode_t listNode;
+	int list = RECENT;
+
+	//Check that blockcache and item exist
+	if (blockcache == NULL || item == NULL)
+		return -1;
+
+	listNode = *blockcache_find(blockcache, key);
+	if (listNode != NULL && listNode->list < RECENT_GHOST)
+	{
+		//Already cached: replace the contents
+		if (listNode->data != item)
+			free(listNode->data);
+		listNode->data = item;
+		blockcache_touch(blockcache, listNode);
+		return 0;
+	}
 
-			return 0;
+	if (listNode != NULL)
+	{
+		//Back soon after being evicted: used more than once, so it goes on
+		//the FREQUENT list. Not so if it is only being read ahead
+		if (!unused)
+		{
+			if (blockcache->policy == BLOCKCACHE_ARC)
+				blockcache_adapt(blockcache, listNode->list);
+			list = FREQUENT;
 		}
+		blockcache_unlink(blockcache, listNode);
+	}
+
+	listNode = (blockcacheNode_t) malloc(sizeof(struct blockcacheNode));
+	if (listNode == NULL)
+		return -1;
+
+	if (blockcache->size >= blockcache->capacity)
+		blockcache_delete_last(blockcache);
+
+	listNode->data = item;
+	listNode->key = key;
+	listNode->list = list;
+	listNode->references = 0;
+	listNode->dirty = 0;
+	listNode->unused = unused;
+	nodePtr = blockcache_bucket(blockcache, key);
+	listNode->next = *nodePtr;
+	*nodePtr = listNode;
+	intrusive_queue_append(&blockcache->lists[list], &listNode->lruLink);
+
+	//Reflect that blockcache grew in size
+	blockcache->size++;
+	blockcache_bound_ghosts(blockcache);
+	return 0;
+}
+
+int blockcache_insert(blockcache_t blockcache, int key, void* item)
+{
+	return blockcache_add(blockcache, key, item, 0);
+}
+
+int blockcache_prefetch(blockcache_t blockcache, int key, void* item)
+{
+	if (blockcache == NULL || item == NULL || blockcache_lookup(blockcache, key) != NULL)
+		return -1;
+	return blockcache_add(blockcache, key, item, 1);
+}
+
+int blockcache_contains(blockcache_t blockcache, int key)
+{
+	return blockcache != NULL && blockcache_lookup(blockcache, key) != NULL;
+}
+
+int blockcache_hold(blockcache_t blockcache, int key)
+{
+	blockcacheNode_t node;
+
+	if (blockcache == NULL || (node = blockcache_lookup(blockcache, key)) == NULL)
+		return -1;
+
+	node->references++;
+	return 0;
+}
+
+int blockcache_release(blockcache_t blockcache, int key)
+{
+	blockcacheNode_t node;
+
+	if (blockcache == NULL || (node = blockcache_lookup(blockcache, key)) == NULL ||
+		node->references == 0)
+		return -1;
+
+	node->references--;
+	blockcache_shrink(blockcache);
+	return 0;
+}
+
+int blockcache_mark_dirty(blockcache_t blockcache, int key)
+{
+	blockcacheNode_t node;
+
+	if (blockcache == NULL || (node = blockcache_lookup(blockcache, key)) == NULL)
+		return -1;
+
+	if (!node->dirty)
+	{
+		node->dirty = 1;
+		intrusive_queue_append(&blockcache->dirty, &node->dirtyLink);
 	}
-	//else return null and -1 if the blockcache is empty or item doesnt exist
-	*item = NULL;						
+	return 0;
+}
+
+int blockcache_next_dirty(blockcache_t blockcache, int *key, void **item)
+{
+	blockcacheNode_t node;
+
+	if (blockcache == NULL || blockcache->dirty.front == NULL)
+		return -1;
+
+	node = queue_entry(blockcache->dirty.front, struct blockcacheNode, dirtyLink);
+	*key = node->key;
+	*item = node->data;
+	return 0;
+}
+
+int blockcache_mark_clean(blockcache_t blockcache, int key)
+{
+	blockcacheNode_t node;
+
+	if (blockcache == NULL || (node = blockcache_lookup(blockcache, key)) == NULL ||
+		!node->dirty)
+		return -1;
+
+	node->dirty = 0;
+	intrusive_queue_delete(&blockcache->dirty, &node->dirtyLink);
+	blockcache_shrink(blockcache);
+	return 0;
+}
+
+int blockcache_dirty_length(blockcache_t blockcache)
+{
+	if (blockcache != NULL)
+		return intrusive_queue_length(&blockcache->dirty);
+	//else
+	return 0;
+}
+
+/*
+ * Remove the block the policy would evict next, returning its data in
+ * *item. Return 0 (success) or -1 (failure).
+ */
+int blockcache_dequeue(blockcache_t blockcache, void** item)
+{
+	blockcacheNode_t oldest;
+
+	if (item == NULL)
+		return -1;
+
+	if (blockcache != NULL && (oldest = blockcache_victim(blockcache)) != NULL)
+	{
+		*item = blockcache_unlink(blockcache, oldest);
+		return 0;
+	}
+	//else return null and -1 if the blockcache is empty
+	*item = NULL;
 	return -1;
 }
 
 /*
  * Free the blockcache and return 0 (success) or -1 (failure).
  */
-int blockcache_free(blockcache_t blockcache) 
+int blockcache_free(blockcache_t blockcache)
 {
-	blockcacheNode_t frontNode;
-	blockcacheNode_t tempNode;
+	blockcacheNode_t node;
+	queue_link_t link;
+	int list;
 
 	//Make sure blockcache exists
-	if (blockcache != NULL)
+	if (blockcache == NULL)
+		return -1;
+
+	for (list = 0; list < LISTS; list++)
 	{
-		frontNode = blockcache->front;
-		while (frontNode != NULL)
+		while ((link = intrusive_queue_dequeue(&blockcache->lists[list])) != NULL)
 		{
-			tempNode = frontNode;
-			frontNode = frontNode->next;
-			free(tempNode);							
+			node = queue_entry(link, struct blockcacheNode, lruLink);
+			free(node);
 		}
-		free(blockcache);
-		return 0;
 	}
-	//else 
-	return -1;
+	free(blockcache->buckets);
+	free(blockcache);
+	return 0;
 }
 
 /*
@@ -135,108 +542,93 @@ int blockcache_isEmpty(blockcache_t blockcache)
 }
 
 /*
- * Return the number of items in the blockcache.
+ * Return the number of blocks in the blockcache.
  */
-int blockcache_length(blockcache_t blockcache) 
+int blockcache_length(blockcache_t blockcache)
 {
-	//If queue is not empty
 	if (blockcache != NULL)
 		return blockcache->size;
-	//else 
+	//else
 	return 0;
 }
 
-void blockcache_delete_last(blockcache_t blockcache) 
+int blockcache_capacity(blockcache_t blockcache)
 {
-	blockcacheNode_t lastPtr = NULL;
-	blockcacheNode_t currentPtr;
-	blockcacheNode_t secondLastPtr = NULL;
-	
-	if (blockcache != NULL && blockcache->size > 2)
-	{	
-		currentPtr = blockcache->front;
+	if (blockcache != NULL)
+		return blockcache->capacity;
+	//else
+	return 0;
+}
 
-		while (currentPtr != NULL)
-		{	
-			secondLastPtr = lastPtr;
-			lastPtr = currentPtr;
-			currentPtr = currentPtr->next;
-		}
-		secondLastPtr->next = NULL;
-		free(lastPtr->data);
-		free(lastPtr);
-		blockcache->size--;
+void blockcache_delete_last(blockcache_t blockcache)
+{
+	blockcacheNode_t oldest;
+
+	if (blockcache == NULL || (oldest = blockcache_victim(blockcache)) == NULL)
+		return;
+
+	blockcache->evictions++;
+	if (blockcache->policy == BLOCKCACHE_LRU ||
+		(blockcache->policy == BLOCKCACHE_2Q && oldest->list == FREQUENT))
+	{
+		free(blockcache_unlink(blockcache, oldest));
+		return;
 	}
 
+	//Keep it as a ghost
+	free(oldest->data);
+	oldest->data = NULL;
+	blockcache_move(blockcache, oldest, oldest->list == RECENT ? RECENT_GHOST : FREQUENT_GHOST);
+	blockcache->size--;
+	blockcache_bound_ghosts(blockcache);
 }
 
 /*
- * Delete the specified item from the given blockcache.
+ * Delete the specified block from the given blockcache.
  * Return 0 on success. Return -1 on error.
  */
-int blockcache_delete(blockcache_t blockcache, int id) 
+int blockcache_delete(blockcache_t blockcache, int key)
 {
-	blockcacheNode_t nodeToDelete;
-	blockcacheNode_t lastPtr = NULL;
-	blockcacheNode_t currentPtr;
-	
-	if (blockcache != NULL)
-	{	
-		currentPtr = blockcache->front;
-
-		while (currentPtr != NULL)
-		{	
-			//Item Found
-			if(currentPtr->key == id)
-			{		
-				if (lastPtr != NULL)
-					lastPtr->next = currentPtr->next;
-				
-				if (blockcache->front == currentPtr)
-					blockcache->front = currentPtr->next;
-
-				nodeToDelete = currentPtr;
-				currentPtr = currentPtr->next;
-
-				blockcache->size--;
-
-				free(nodeToDelete);
-				return 0;
-			}
-			//Item not found
-			else 
-			{
-				lastPtr = currentPtr;
-				currentPtr = currentPtr->next;
-			}
-		}
-	}
-	return -1;
+	blockcacheNode_t node;
+
+	if (blockcache == NULL)
+		return -1;
+
+	node = blockcache_lookup(blockcache, key);
+	if (node == NULL)
+		return -1;
+
+	blockcache_unlink(blockcache, node);
+	return 0;
 }
 
-int blockcache_get(blockcache_t list, int id, void **item)
-{
-	blockcacheNode_t currentPtr;
-	
-	if (list != NULL && list->size > 0)
-	{	
-		currentPtr = list->front;
-
-		while (currentPtr != NULL)
-		{	
-			//Item Found
-			if(currentPtr->key == id)
-			{		
-				*item = currentPtr->data;
-				return 1;
-			}
-			//Item not found
-			else 
-			{
-				currentPtr = currentPtr->next;
-			}
-		}
+int blockcache_get(blockcache_t blockcache, int key, void **item)
+{
+	blockcacheNode_t node;
+
+	if (blockcache == NULL || item == NULL)
+		return -1;
+
+	node = blockcache_lookup(blockcache, key);
+	if (node == NULL)
+	{
+		blockcache->misses++;
+		*item = NULL;
+		return -1;
 	}
-	*item = NULL;
-	return -1;
+
+	blockcache->hits++;
+	blockcache_touch(blockcache, node);
+	*item = node->data;
+	return 0;
+}
+
+void blockcache_stats(blockcache_t blockcache, long *hits, long *misses, long *evictions)
+{
+	if (hits != NULL)
+		*hits = blockcache != NULL ? blockcache->hits : 0;
+	if (misses != NULL)
+		*misses = blockcache != NULL ? blockcache->misses : 0;
+	if (evictions != NULL)
+		*evictions = blockcache != NULL ? blockcache->evictions : 0;
 }
@@ -1,34 +1,154 @@
+/*
+ * Disk block cache
+ */
+#ifndef __BLOCKCACHE_H__
+#define __BLOCKCACHE_H__
 
 /*
- * queue_t is a pointer to an internally maintained data structure.
- * Clients of this package do not need to know how queues are
- * represented.  They see and manipulate only queue_t's.
+ * A block cache maps block numbers to buffers holding their contents. It
+ * holds up to a fixed number of blocks, and makes room for a new one by
+ * evicting one chosen by its replacement policy. Blocks are found through a
+ * hash table and kept in use order on doubly linked lists, so looking up,
+ * inserting and evicting a block all take constant time.
+ *
+ * The policies are
+ *  BLOCKCACHE_LRU: evict the least recently used block.
+ *  BLOCKCACHE_2Q: blocks start on a FIFO of a quarter of the capacity, and
+ *   move to an LRU list only if they are used again after leaving it,
+ *   which the cache remembers for half the capacity's worth of blocks. A
+ *   scan passes through the FIFO without evicting blocks used often.
+ *  BLOCKCACHE_ARC: blocks used once and blocks used more than once are on
+ *   two LRU lists, and the cache remembers as many blocks evicted from
+ *   them as it holds. The split between the two lists adapts to which of
+ *   them loses the blocks that are wanted again, so it is scan resistant
+ *   while still caching a working set seen only once before.
+ * cachesim compares them on a trace of the blocks a program used.
+ *
+ * The cache owns the buffers inserted into it and frees them when they
+ * are evicted or replaced; blockcache_delete and blockcache_dequeue hand
+ * them back to the caller instead. A block can be held while it is in use,
+ * which keeps it from being evicted: if every block is held, the cache
+ * grows past its capacity, and shrinks back as blocks are released.
+ *
+ * For write-back caching, a block can be marked dirty when its buffer is
+ * newer than the disk. Dirty blocks are not evicted either, until whoever
+ * writes them back marks them clean.
+ *
+ * The cache is not synchronized: callers sharing a cache between threads
+ * must serialize their calls.
+ *
+ * blockcache_t is a pointer to an internally maintained data structure.
+ * Clients of this package do not need to know how caches are
+ * represented. They see and manipulate only blockcache_t's.
  */
 typedef struct blockcache* blockcache_t;
 typedef struct blockcacheNode* blockcacheNode_t;
 
+typedef enum { BLOCKCACHE_LRU, BLOCKCACHE_2Q, BLOCKCACHE_ARC } blockcache_policy_t;
+
+//Capacity of a cache made by blockcache_new, in blocks
+#define BLOCKCACHE_DEFAULT_CAPACITY 4096
+
 /*
- * Return an empty queue.  Returns NULL on error.
+ * Return an empty LRU cache of BLOCKCACHE_DEFAULT_CAPACITY blocks.
+ * Returns NULL on error.
  */
 extern blockcache_t blockcache_new();
 
 /*
- * Appends a void* to a blockcache (both specifed as parameters).  Return
- * 0 (success) or -1 (failure).
+ * Return an empty LRU cache holding up to capacity blocks. Returns NULL on
+ * error.
+ */
+extern blockcache_t blockcache_create(int capacity);
+
+/*
+ * Return an empty cache holding up to capacity blocks and evicting them by
+ * policy. Returns NULL on error.
+ */
+extern blockcache_t blockcache_create_policy(int capacity, blockcache_policy_t policy);
+
+/*
+ * Return an empty LRU cache holding as many blocks of blockSize bytes as
+ * fit in bytes, and at least one. Returns NULL on error.
  */
-extern int blockcache_insert(blockcache_t list, int key, void* data);
+extern blockcache_t blockcache_create_bytes(long bytes, int blockSize);
 
-extern int blockcache_get(blockcache_t list, int key, void **item);
+/*
+ * Cache data as the contents of block key, replacing (and freeing) what
+ * was cached for it before, which counts as using it. If the cache is
+ * full, a block that is neither held nor dirty is evicted first. A block
+ * must not be replaced while it is held.
+ * Return 0 (success) or -1 (failure).
+ */
+extern int blockcache_insert(blockcache_t blockcache, int key, void* data);
 
 /*
- * Dequeue and return the first void* from the queue.
- * Return 0 (success) and first item if queue is nonempty, or -1 (failure) and
- * NULL if queue is empty.
+ * Cache data as the contents of block key, which is not cached, as read
+ * before it was asked for. Until it is first got it is not counted as
+ * used, so reading ahead through a file does not make its blocks look
+ * like a working set. Return 0 (success) or -1 (failure, or key cached).
  */
-extern int blockcache_dequeue(blockcache_t list, void** item);
+extern int blockcache_prefetch(blockcache_t blockcache, int key, void* data);
 
 /*
- * Free the blockcache and return 0 (success) or -1 (failure).
+ * Return 1 if block key is cached, or 0 otherwise, without counting a hit
+ * or miss or marking the block used.
+ */
+extern int blockcache_contains(blockcache_t blockcache, int key);
+
+/*
+ * Look up block key, counting a hit or a miss. On a hit, the block
+ * is marked as just used, *item is set to its data and 0 is
+ * returned. On a miss, *item is set to NULL and -1 is returned.
+ */
+extern int blockcache_get(blockcache_t blockcache, int key, void **item);
+
+/*
+ * Take a reference to block key, which keeps it in the cache until it is
+ * released. Returns 0 if it was there, or -1 otherwise.
+ */
+extern int blockcache_hold(blockcache_t blockcache, int key);
+
+/*
+ * Drop a reference taken by blockcache_hold. Returns 0 if block key was
+ * there and held, or -1 otherwise.
+ */
+extern int blockcache_release(blockcache_t blockcache, int key);
+
+/*
+ * Mark block key dirty. Marking a dirty block again does nothing, so it is
+ * written back once however often it changed. Returns 0 if it was there,
+ * or -1 otherwise.
+ */
+extern int blockcache_mark_dirty(blockcache_t blockcache, int key);
+
+/*
+ * Find the block that has been dirty longest, setting *key to its number
+ * and *item to its data. Returns 0, or -1 if no block is dirty.
+ */
+extern int blockcache_next_dirty(blockcache_t blockcache, int *key, void **item);
+
+/*
+ * Mark block key clean once it is written back, letting it be evicted.
+ * Returns 0 if it was there and dirty, or -1 otherwise.
+ */
+extern int blockcache_mark_clean(blockcache_t blockcache, int key);
+
+/*
+ * Return the number of dirty blocks, or 0 if blockcache is NULL.
+ */
+extern int blockcache_dirty_length(blockcache_t blockcache);
+
+/*
+ * Remove the block that would be evicted next, which is neither held nor
+ * dirty, and return its data in *item without freeing it. Return 0 (success), or -1
+ * and NULL if there is no such block.
+ */
+extern int blockcache_dequeue(blockcache_t blockcache, void** item);
+
+/*
+ * Free the cache, but not the data cached in it. Return 0 (success) or
+ * -1 (failure).
  */
 extern int blockcache_free (blockcache_t blockcache);
 
@@ -38,18 +158,32 @@ extern int blockcache_free (blockcache_t blockcache);
 extern int blockcache_isEmpty(blockcache_t blockcache);
 
 /*
- * Return the number of items in the blockcache, or -1 if an error occured
+ * Return the number of blocks in the blockcache, or 0 if it is NULL.
  */
 extern int blockcache_length(blockcache_t blockcache);
 
 /*
- * Removes the item at the end of the list. Used to maintain size invariant. 
+ * Return the most blocks the blockcache holds, or 0 if it is NULL.
+ */
+extern int blockcache_capacity(blockcache_t blockcache);
+
+/*
+ * Evict the block the policy picks among those neither held nor dirty,
+ * freeing its data.
+ * Used to maintain the size invariant.
  */
 extern void blockcache_delete_last(blockcache_t blockcache);
 
 /*
- * Delete the first instance of the specified item from the given blockcache.
- * Returns 0 if an element was deleted, or -1 otherwise.
+ * Remove block key from the blockcache without freeing its data.
+ * Returns 0 if it was there, or -1 otherwise.
  */
 extern int blockcache_delete(blockcache_t blockcache, int key);
 
+/*
+ * Report the lookups that hit and missed, and the blocks evicted, since
+ * the cache was made. Any of the pointers may be NULL.
+ */
+extern void blockcache_stats(blockcache_t blockcache, long *hits, long *misses, long *evictions);
+
+#endif /*__BLOCKCACHE_H__*/
@@ -9,6 +9,7 @@
 #include <stdlib.h>
 
 #define LIMIT 30
+#define BLOCKS 8192
 int x = 0;
 
 void iter(void *cur, void *ptr) 
@@ -16,6 +17,21 @@ void iter(void *cur, void *ptr)
 	x += 1;
 }	
 
+//Look up block key, caching it on a miss and looking it up again, as
+//minifile does
+void use_block(blockcache_t cache, int key)
+{
+	void *data;
+	int *loc;
+
+	if (blockcache_get(cache, key, &data) == 0)
+		return;
+	loc = (int *) malloc(sizeof(int));
+	*loc = key;
+	blockcache_insert(cache, key, (void *) loc);
+	blockcache_get(cache, key, &data);
+}
+
 int main(int argc, char *argv[]) 
 {
 	void *hi = NULL;
@@ -24,6 +40,8 @@ int main(int argc, char *argv[])
 	int **iptr;
 	int a = 0, b = 1, c = 2, d = 4, e = 5, f = 6;
 	int *loc;
+	long hits, misses, evictions;
+	blockcache_policy_t policy;
 
 	//See that list is empty
 	if (blockcache_isEmpty(testcache) != 1)
@@ -71,7 +89,7 @@ int main(int argc, char *argv[])
 	
 
 	// End standard linked list tests, begin block cache tests
-	testcache = blockcache_new();
+	testcache = blockcache_create(LIMIT);
 	for (a = 0; a < 100; a++) {
 		loc = (int *) malloc(sizeof(int));	
 		*loc = a;
@@ -90,6 +108,135 @@ int main(int argc, char *argv[])
 			printf("Blockcache test 2 failed key %d not present\n", a);
 		}
 	}
+	if (blockcache_get(testcache, 0, ptr) == 0)
+		printf("Blockcache test 3 failed, key 0 not evicted\n");
+
+	//Using 70 keeps it cached while 71 and the rest of the oldest go
+	blockcache_get(testcache, 70, ptr);
+	for (a = 100; a < 110; a++) {
+		loc = (int *) malloc(sizeof(int));
+		*loc = a;
+		blockcache_insert(testcache, a, (void *) loc);
+	}
+	if (blockcache_get(testcache, 70, ptr) != 0)
+		printf("LRU test 1 failed, recently used key 70 evicted\n");
+	if (blockcache_get(testcache, 71, ptr) == 0)
+		printf("LRU test 2 failed, least recently used key 71 not evicted\n");
+	blockcache_dequeue(testcache, ptr);
+	iptr = (int **) ptr;
+	if (**iptr != 81)
+		printf("LRU test 3 failed. Expected to dequeue 81, dequeued %d\n", **iptr);
+	free(*ptr);
+
+	blockcache_stats(testcache, &hits, &misses, &evictions);
+	if (hits != 12 || misses != 2 || evictions != 80)
+		printf("Stats test failed: %ld hits, %ld misses, %ld evictions\n", hits, misses, evictions);
+	blockcache_free(testcache);
+
+	//Held blocks are passed over for eviction until released
+	testcache = blockcache_create(2);
+	for (a = 0; a < 2; a++) {
+		loc = (int *) malloc(sizeof(int));
+		*loc = a;
+		blockcache_insert(testcache, a, (void *) loc);
+		blockcache_hold(testcache, a);
+	}
+	loc = (int *) malloc(sizeof(int));
+	*loc = 2;
+	blockcache_insert(testcache, 2, (void *) loc);
+	if (blockcache_length(testcache) != 3 || blockcache_get(testcache, 0, ptr) != 0)
+		printf("Hold test 1 failed, held block evicted\n");
+	//Using 0 made 2 the least recently used
+	blockcache_release(testcache, 0);
+	if (blockcache_length(testcache) != 2 || blockcache_get(testcache, 0, ptr) != 0 ||
+		blockcache_get(testcache, 2, ptr) == 0)
+		printf("Hold test 2 failed, wrong block evicted on release\n");
+	if (blockcache_release(testcache, 0) != -1)
+		printf("Hold test 3 failed, released a block not held\n");
+	blockcache_free(testcache);
+
+	//Dirty blocks are passed over for eviction until cleaned
+	testcache = blockcache_create(2);
+	for (a = 0; a < 4; a++) {
+		loc = (int *) malloc(sizeof(int));
+		*loc = a;
+		blockcache_insert(testcache, a, (void *) loc);
+		if (a != 1)
+			blockcache_mark_dirty(testcache, a);
+	}
+	blockcache_mark_dirty(testcache, 0);
+	if (blockcache_length(testcache) != 3 || blockcache_dirty_length(testcache) != 3 ||
+		blockcache_get(testcache, 1, ptr) == 0)
+		printf("Dirty test 1 failed, dirty block evicted\n");
+	if (blockcache_next_dirty(testcache, &a, ptr) != 0 || a != 0 || **(int **) ptr != 0)
+		printf("Dirty test 2 failed, expected block 0 dirty longest\n");
+	blockcache_mark_clean(testcache, 0);
+	if (blockcache_length(testcache) != 2 || blockcache_dirty_length(testcache) != 2 ||
+		blockcache_get(testcache, 0, ptr) == 0)
+		printf("Dirty test 3 failed, cleaned block not evicted\n");
+	if (blockcache_mark_clean(testcache, 0) != -1)
+		printf("Dirty test 4 failed, cleaned a block not cached\n");
+	blockcache_free(testcache);
+
+	//Blocks used again while a scan runs stay cached through a second scan
+	//twice the size of the cache under 2Q and ARC, but not LRU
+	for (policy = BLOCKCACHE_LRU; policy <= BLOCKCACHE_ARC; policy++) {
+		testcache = blockcache_create_policy(LIMIT, policy);
+		for (a = 0; a < 4 * LIMIT; a++) {
+			use_block(testcache, 1000 + a);
+			use_block(testcache, a % (LIMIT / 3));
+		}
+		for (a = 0; a < 2 * LIMIT; a++)
+			use_block(testcache, 2000 + a);
+		for (a = 0, b = 0; a < LIMIT / 3; a++)
+			b += blockcache_get(testcache, a, ptr) == 0;
+		if (policy == BLOCKCACHE_LRU ? b != 0 : b != LIMIT / 3)
+			printf("Scan test failed for policy %d, %d of %d blocks cached\n", policy, b, LIMIT / 3);
+		if (blockcache_length(testcache) != LIMIT)
+			printf("Scan length test failed for policy %d\n", policy);
+		blockcache_free(testcache);
+	}
+
+	//Blocks read ahead and then read once are not kept through a scan
+	testcache = blockcache_create_policy(LIMIT, BLOCKCACHE_ARC);
+	for (a = 0; a < LIMIT / 3; a++) {
+		loc = (int *) malloc(sizeof(int));
+		*loc = a;
+		blockcache_prefetch(testcache, a, (void *) loc);
+	}
+	if (blockcache_contains(testcache, 0) != 1 || blockcache_contains(testcache, LIMIT) != 0)
+		printf("Contains test failed\n");
+	for (a = 0; a < LIMIT / 3; a++)
+		use_block(testcache, a);
+	blockcache_stats(testcache, &hits, &misses, &evictions);
+	if (hits != LIMIT / 3 || misses != 0)
+		printf("Prefetch test 1 failed: %ld hits, %ld misses\n", hits, misses);
+	for (a = 0; a < 2 * LIMIT; a++)
+		use_block(testcache, 2000 + a);
+	for (a = 0, b = 0; a < LIMIT / 3; a++)
+		b += blockcache_contains(testcache, a);
+	if (b != 0)
+		printf("Prefetch test 2 failed, %d blocks read once kept\n", b);
+	blockcache_free(testcache);
+
+	//A working set of thousands of blocks
+	testcache = blockcache_create_bytes(BLOCKS * 4096L, 4096);
+	if (blockcache_capacity(testcache) != BLOCKS)
+		printf("Capacity test failed\n");
+	for (a = 0; a < 4 * BLOCKS; a++) {
+		loc = (int *) malloc(sizeof(int));
+		*loc = a;
+		blockcache_insert(testcache, a * 8, (void *) loc);
+	}
+	for (a = 3 * BLOCKS; a < 4 * BLOCKS; a++) {
+		if (blockcache_get(testcache, a * 8, ptr) != 0 || **(int **) ptr != a)
+		{
+			printf("Working set test failed key %d not present\n", a * 8);
+			break;
+		}
+	}
+	if (blockcache_length(testcache) != BLOCKS)
+		printf("Working set length test failed\n");
 	return 0;
 }
 
@@ -0,0 +1,129 @@
+/* cachesim.c
+
+   Replays a trace of block numbers through block caches of each
+   replacement policy and a range of capacities, and prints the hit rate
+   of each. A trace is block numbers separated by white space, in the
+   order they were used; minifile records one to the file named by
+   minifile_block_trace.
+
+   This runs on the host, without the minithread system.
+
+   usage: cachesim trace-file [capacity ...]
+*/
+
+#include "blockcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define POLICIES 3
+
+char* policyNames[POLICIES] = { "LRU", "2Q", "ARC" };
+blockcache_policy_t policies[POLICIES] = { BLOCKCACHE_LRU, BLOCKCACHE_2Q, BLOCKCACHE_ARC };
+int defaultCapacities[] = { 16, 64, 256, 1024, 4096 };
+
+/* the hit rate, in percent, of a cache replaying trace */
+double replay(int* trace, long length, int capacity, blockcache_policy_t policy) {
+  blockcache_t cache = blockcache_create_policy(capacity, policy);
+  void* data;
+  long hits;
+  long i;
+
+  if (cache == NULL) {
+    fprintf(stderr, "cannot make a cache of %d blocks\n", capacity);
+    exit(1);
+  }
+  for (i = 0; i < length; i++) {
+    /* the cache frees what it evicts */
+    if (blockcache_get(cache, trace[i], &data) < 0)
+      blockcache_insert(cache, trace[i], malloc(1));
+  }
+  blockcache_stats(cache, &hits, NULL, NULL);
+  while (blockcache_dequeue(cache, &data) == 0)
+    free(data);
+  blockcache_free(cache);
+  return length > 0 ? 100.0 * hits / length : 0;
+}
+
+/* the number of different blocks in trace, for the hit rate an infinite
+   cache would get */
+long distinct(int* trace, long length) {
+  blockcache_t seen = blockcache_create(length > 0 ? length : 1);
+  void* data;
+  long count = 0;
+  long i;
+
+  for (i = 0; i < length; i++) {
+    if (blockcache_get(seen, trace[i], &data) < 0) {
+      blockcache_insert(seen, trace[i], malloc(1));
+      count++;
+    }
+  }
+  while (blockcache_dequeue(seen, &data) == 0)
+    free(data);
+  blockcache_free(seen);
+  return count;
+}
+
+int
+main(int argc, char *argv[]) {
+  int* trace;
+  long length = 0;
+  long room = 4096;
+  long blocks;
+  int* capacities = defaultCapacities;
+  int count = sizeof(defaultCapacities) / sizeof(int);
+  int block;
+  FILE* in;
+  int c, p;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s trace-file [capacity ...]\n", argv[0]);
+    return 1;
+  }
+  in = fopen(argv[1], "r");
+  if (in == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  trace = (int *) malloc(room * sizeof(int));
+  while (fscanf(in, "%d", &block) == 1) {
+    if (length == room) {
+      room *= 2;
+      trace = (int *) realloc(trace, room * sizeof(int));
+    }
+    trace[length++] = block;
+  }
+  if (!feof(in)) {
+    fprintf(stderr, "%s: not a trace file\n", argv[1]);
+    return 1;
+  }
+  fclose(in);
+
+  if (argc > 2) {
+    count = argc - 2;
+    capacities = (int *) malloc(count * sizeof(int));
+    for (c = 0; c < count; c++) {
+      capacities[c] = atoi(argv[c + 2]);
+      if (capacities[c] <= 0) {
+        fprintf(stderr, "%s: not a capacity\n", argv[c + 2]);
+        return 1;
+      }
+    }
+  }
+
+  blocks = distinct(trace, length);
+  printf("%ld accesses to %ld blocks, at most %.2f%% hits\n", length, blocks,
+      length > 0 ? 100.0 * (length - blocks) / length : 0);
+  printf("%10s", "capacity");
+  for (p = 0; p < POLICIES; p++)
+    printf("%10s", policyNames[p]);
+  printf("\n");
+  for (c = 0; c < count; c++) {
+    printf("%10d", capacities[c]);
+    for (p = 0; p < POLICIES; p++)
+      printf("%9.2f%%", replay(trace, length, capacities[c], policies[p]));
+    printf("\n");
+  }
+  return 0;
+}
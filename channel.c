@@ -0,0 +1,210 @@
+/*
+ * Bounded channel manipulation functions
+ */
+#include "channel.h"
+#include "interrupts.h"
+#include "minithread.h"
+#include "queue.h"
+#include <stdlib.h>
+
+/*
+ * The buffer and the wait queues are guarded by disabling interrupts, as
+ * for semaphores. A waiting thread is woken when what it waits for might
+ * be there and checks again, and passes the wakeup on to the next waiter
+ * if something is left over, so each send or receive wakes at most one
+ * thread on either side.
+ */
+struct channel {
+	int capacity;
+	int head; //Index of the oldest value
+	int count; //Values in the buffer
+	int closed;
+	void** items;
+	struct intrusive_queue senders; //Threads waiting for room, linked through their minithread
+	struct intrusive_queue receivers; //Threads waiting for values, linked through their minithread
+};
+
+
+//HELPER FUNCTIONS
+/*
+ * Wake the thread that has waited longest on waiters, if any.
+ * Interrupts must be disabled.
+ */
+static void
+channel_wake(intrusive_queue_t waiters)
+{
+	queue_link_t link = intrusive_queue_dequeue(waiters);
+
+	if (link != NULL)
+		minithread_start(queue_entry(link, struct minithread, link));
+}
+
+/*
+ * Wake every thread waiting on waiters. Interrupts must be disabled.
+ */
+static void
+channel_wake_all(intrusive_queue_t waiters)
+{
+	while (intrusive_queue_length(waiters) > 0)
+		channel_wake(waiters);
+}
+
+/*
+ * Wait on waiters until woken. Interrupts must be disabled, and are
+ * disabled again on return.
+ */
+static void
+channel_wait(intrusive_queue_t waiters)
+{
+	intrusive_queue_append(waiters, &minithread_self()->link);
+	minithread_stop();
+	//Threads are switched back to with interrupts enabled
+	set_interrupt_level(DISABLED);
+}
+
+
+//REQUIRED FUNCTIONS
+channel_t
+channel_create(int capacity)
+{
+	channel_t channel;
+
+	if (capacity <= 0)
+		return NULL;
+
+	channel = (channel_t) malloc(sizeof(struct channel));
+	if (channel == NULL)
+		return NULL;
+
+	channel->items = (void**) malloc(sizeof(void*) * capacity);
+	if (channel->items == NULL)
+	{
+		free(channel);
+		return NULL;
+	}
+	channel->capacity = capacity;
+	channel->head = 0;
+	channel->count = 0;
+	channel->closed = 0;
+	intrusive_queue_init(&channel->senders);
+	intrusive_queue_init(&channel->receivers);
+
+	return channel;
+}
+
+void
+channel_destroy(channel_t channel)
+{
+	if (channel == NULL)
+		return;
+
+	free(channel->items);
+	free(channel);
+}
+
+int
+channel_send(channel_t channel, void* item)
+{
+	return channel_send_batch(channel, &item, 1) == 1 ? 0 : -1;
+}
+
+int
+channel_send_batch(channel_t channel, void** items, int count)
+{
+	interrupt_level_t previousLevel;
+	int sent = 0;
+	int tail;
+	int n;
+
+	if (channel == NULL || items == NULL || count < 0)
+		return -1;
+
+	previousLevel = set_interrupt_level(DISABLED);
+
+	while (sent < count && !channel->closed)
+	{
+		if (channel->count == channel->capacity)
+		{
+			channel_wait(&channel->senders);
+			continue;
+		}
+
+		//Fill the buffer up to its end, then wrap around on the next pass
+		tail = (channel->head + channel->count) % channel->capacity;
+		n = count - sent;
+		if (n > channel->capacity - channel->count)
+			n = channel->capacity - channel->count;
+		if (n > channel->capacity - tail)
+			n = channel->capacity - tail;
+
+		for (; n > 0; n--)
+		{
+			channel->items[tail++] = items[sent++];
+			channel->count++;
+		}
+		channel_wake(&channel->receivers);
+	}
+
+	//Pass on room we did not use
+	if (channel->count < channel->capacity)
+		channel_wake(&channel->senders);
+
+	set_interrupt_level(previousLevel);
+
+	return sent;
+}
+
+int
+channel_receive(channel_t channel, void** item)
+{
+	return channel_receive_batch(channel, item, 1) == 1 ? 0 : -1;
+}
+
+int
+channel_receive_batch(channel_t channel, void** items, int max)
+{
+	interrupt_level_t previousLevel;
+	int received = 0;
+
+	if (channel == NULL || items == NULL || max <= 0)
+		return -1;
+
+	previousLevel = set_interrupt_level(DISABLED);
+
+	while (channel->count == 0 && !channel->closed)
+		channel_wait(&channel->receivers);
+
+	while (received < max && channel->count > 0)
+	{
+		items[received++] = channel->items[channel->head];
+		channel->head = (channel->head + 1) % channel->capacity;
+		channel->count--;
+	}
+
+	if (received > 0)
+		channel_wake(&channel->senders);
+	//Pass on values we did not take
+	if (channel->count > 0)
+		channel_wake(&channel->receivers);
+
+	set_interrupt_level(previousLevel);
+
+	return received;
+}
+
+void
+channel_close(channel_t channel)
+{
+	interrupt_level_t previousLevel;
+
+	if (channel == NULL)
+		return;
+
+	previousLevel = set_interrupt_level(DISABLED);
+
+	channel->closed = 1;
+	channel_wake_all(&channel->senders);
+	channel_wake_all(&channel->receivers);
+
+	set_interrupt_level(previousLevel);
+}
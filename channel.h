@@ -0,0 +1,65 @@
+/*
+ * Bounded channels between minithreads
+ */
+#ifndef __CHANNEL_H__
+#define __CHANNEL_H__
+
+/*
+ * A channel carries void*'s from any number of sending threads to any
+ * number of receiving threads, in the order they were sent, through a
+ * ring buffer of fixed capacity. Senders wait while it is full and
+ * receivers while it is empty, so a thread only switches away when it
+ * cannot make progress; moving values in batches lets a pipeline stage
+ * pass on many values per switch.
+ *
+ * channel_t is a pointer to an internally maintained data structure.
+ * Clients of this package do not need to know how channels are
+ * represented. They see and manipulate only channel_t's.
+ */
+typedef struct channel* channel_t;
+
+/*
+ * Return an empty, open channel holding up to capacity values. Returns
+ * NULL on error.
+ */
+extern channel_t channel_create(int capacity);
+
+/*
+ * Deallocate a channel. Nobody may be waiting on it.
+ */
+extern void channel_destroy(channel_t channel);
+
+/*
+ * Send item, waiting for room if the channel is full. Return 0 on
+ * success, or -1 if the channel is closed.
+ */
+extern int channel_send(channel_t channel, void* item);
+
+/*
+ * Send the count values in items, in order, waiting for room as needed.
+ * Return the number sent, which is less than count only if the channel
+ * is closed, or -1 on error.
+ */
+extern int channel_send_batch(channel_t channel, void** items, int count);
+
+/*
+ * Receive the oldest value in the channel into *item, waiting for one if
+ * the channel is empty. Return 0 on success, or -1 if the channel is
+ * closed and empty.
+ */
+extern int channel_receive(channel_t channel, void** item);
+
+/*
+ * Receive up to max values into items, oldest first, waiting only until
+ * at least one is available. Return the number received, 0 if the
+ * channel is closed and empty, or -1 on error.
+ */
+extern int channel_receive_batch(channel_t channel, void** items, int max);
+
+/*
+ * Close the channel. Nothing more can be sent; receivers get the values
+ * already in it, and are then told the channel is closed.
+ */
+extern void channel_close(channel_t channel);
+
+#endif /*__CHANNEL_H__*/
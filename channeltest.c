@@ -0,0 +1,216 @@
+/* channeltest.c
+
+   Tests of the bounded channels in channel.h, run on several scheduler
+   workers. Each failure is printed, and the exit status is the number of
+   failures.
+*/
+
+#include "minithread.h"
+#include "synch.h"
+#include "channel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WORKERS 4
+
+/* threads left blocked on a channel when it is closed */
+#define BLOCKED 3
+/* milliseconds to let them block */
+#define SETTLE 50
+
+/* values streamed through a small channel in odd-sized batches */
+#define VALUES 10000
+#define CAPACITY 5
+#define SEND_BATCH 7
+#define RECEIVE_BATCH 4
+
+semaphore_t finished;
+int failures = 0;
+
+channel_t channel;
+int closedCount;
+int sentCount;
+
+void fail(char* test, char* what) {
+  printf("%s test failed: %s\n", test, what);
+  failures++;
+}
+
+/* wait for count threads to V finished */
+void join(int count) {
+  while (count-- > 0)
+    semaphore_P(finished);
+}
+
+int receiver(int* arg) {
+  void* item;
+
+  if (channel_receive(channel, &item) == -1)
+    __sync_add_and_fetch(&closedCount, 1);
+
+  semaphore_V(finished);
+  return 0;
+}
+
+int sender(int* arg) {
+  if (channel_send(channel, arg) == -1)
+    __sync_add_and_fetch(&closedCount, 1);
+
+  semaphore_V(finished);
+  return 0;
+}
+
+/* sends more than fits, so it is left blocked part way */
+int batch_sender(int* arg) {
+  void* items[SEND_BATCH];
+  int i;
+
+  for (i = 0; i < SEND_BATCH; i++)
+    items[i] = (void *) (long) i;
+  sentCount = channel_send_batch(channel, items, SEND_BATCH);
+
+  semaphore_V(finished);
+  return 0;
+}
+
+void test_close() {
+  void* items[CAPACITY];
+  void* item;
+  int i;
+
+  /* receivers waiting on an empty channel are told it closed */
+  channel = channel_create(CAPACITY);
+  closedCount = 0;
+  for (i = 0; i < BLOCKED; i++)
+    minithread_fork(receiver, NULL);
+  minithread_sleep_with_timeout(SETTLE);
+  channel_close(channel);
+  join(BLOCKED);
+  if (closedCount != BLOCKED)
+    fail("Close", "blocked receivers were not told the channel closed");
+  channel_destroy(channel);
+
+  /* senders waiting on a full channel are told it closed, and what was
+     sent before still comes out, in order */
+  channel = channel_create(2);
+  closedCount = 0;
+  channel_send(channel, (void *) 1L);
+  channel_send(channel, (void *) 2L);
+  for (i = 0; i < BLOCKED; i++)
+    minithread_fork(sender, (int *) (long) (i + 3));
+  minithread_sleep_with_timeout(SETTLE);
+  channel_close(channel);
+  join(BLOCKED);
+  if (closedCount != BLOCKED)
+    fail("Close", "blocked senders were not told the channel closed");
+  if (channel_receive(channel, &item) != 0 || item != (void *) 1L ||
+      channel_receive(channel, &item) != 0 || item != (void *) 2L)
+    fail("Close", "values sent before closing were lost");
+  if (channel_receive(channel, &item) != -1 ||
+      channel_receive_batch(channel, items, CAPACITY) != 0)
+    fail("Close", "a closed, empty channel gave a value");
+  if (channel_send(channel, NULL) != -1 ||
+      channel_send_batch(channel, items, CAPACITY) != 0)
+    fail("Close", "a value was sent on a closed channel");
+  channel_destroy(channel);
+
+  /* a batch cut off by closing reports how much of it was sent */
+  channel = channel_create(CAPACITY);
+  minithread_fork(batch_sender, NULL);
+  minithread_sleep_with_timeout(SETTLE);
+  channel_close(channel);
+  join(1);
+  if (sentCount != CAPACITY)
+    fail("Close", "a batch cut off by closing reported the wrong count");
+  if (channel_receive_batch(channel, items, CAPACITY) != CAPACITY ||
+      items[0] != (void *) 0L || items[CAPACITY - 1] != (void *) (long) (CAPACITY - 1))
+    fail("Close", "the start of a batch cut off by closing was lost");
+  channel_destroy(channel);
+}
+
+/* sends 0 to VALUES - 1 in batches, then closes the channel */
+int producer(int* arg) {
+  void* items[SEND_BATCH];
+  long next = 0;
+  int n;
+
+  while (next < VALUES) {
+    for (n = 0; n < SEND_BATCH && next < VALUES; n++)
+      items[n] = (void *) next++;
+    if (channel_send_batch(channel, items, n) != n) {
+      fail("Wrap", "a batch was not all sent");
+      break;
+    }
+  }
+  channel_close(channel);
+
+  semaphore_V(finished);
+  return 0;
+}
+
+void test_wrap() {
+  void* items[RECEIVE_BATCH];
+  long expected;
+  int n;
+  int i;
+
+  /* batches that do not divide the capacity wrap around the end of the
+     buffer at every offset */
+  channel = channel_create(CAPACITY);
+  for (expected = 0; expected < 4 * CAPACITY; expected += 3) {
+    for (i = 0; i < 3; i++)
+      items[i] = (void *) (expected + i);
+    if (channel_send_batch(channel, items, 3) != 3) {
+      fail("Wrap", "a batch did not fit in an empty channel");
+      break;
+    }
+    n = channel_receive_batch(channel, items, RECEIVE_BATCH);
+    if (n != 3 || items[0] != (void *) expected || items[2] != (void *) (expected + 2)) {
+      fail("Wrap", "a batch came out wrong after wrapping around");
+      break;
+    }
+  }
+  channel_destroy(channel);
+
+  /* and every value comes out once, in order, when the two sides race */
+  channel = channel_create(CAPACITY);
+  minithread_fork(producer, NULL);
+  expected = 0;
+  while ((n = channel_receive_batch(channel, items, RECEIVE_BATCH)) > 0) {
+    for (i = 0; i < n; i++)
+      if (items[i] != (void *) expected++) {
+        fail("Wrap", "values were lost or reordered");
+        n = -1;
+        break;
+      }
+    if (n < 0)
+      break;
+  }
+  if (n == 0 && expected != VALUES)
+    fail("Wrap", "the channel closed before every value arrived");
+  /* let the producer go if we gave up */
+  if (n < 0)
+    channel_close(channel);
+  join(1);
+  channel_destroy(channel);
+}
+
+int tests(int* arg) {
+  finished = semaphore_create();
+  semaphore_initialize(finished, 0);
+
+  test_close();
+  test_wrap();
+
+  printf("%d failures\n", failures);
+  exit(failures);
+  return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+  minithread_workers = WORKERS;
+  minithread_system_initialize(tests, NULL);
+  return -1;
+}
@@ -0,0 +1,129 @@
+/* forktree.c
+
+   Fork-tree scaling benchmark. Every node of a binary tree of short-lived
+   minithreads does a little work, forks its two children and exits; the
+   tree is built DEPTH levels deep, ROUNDS times over. The benchmark is run
+   once for each number of scheduler workers from 1 to N, each in its own
+   process since the minithread system can only be initialized once, and
+   the speedup over one worker is reported.
+
+   usage: forktree [N]    (N defaults to the number of online processors)
+*/
+
+#include "minithread.h"
+#include "synch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DEPTH 12
+#define ROUNDS 20
+#define WORK 20000
+
+/* a tree of DEPTH levels has 2^DEPTH - 1 nodes */
+#define NODES ((1 << DEPTH) - 1)
+
+mutex_t mutex;
+semaphore_t done;
+int finished;
+int result;
+
+int node(int* arg) {
+  long depth = (long) arg;
+  volatile int sink = 0;
+  int i;
+
+  for (i = 0; i < WORK; i++)
+    sink += i;
+
+  if (depth > 1) {
+    minithread_fork(node, (int *) (depth - 1));
+    minithread_fork(node, (int *) (depth - 1));
+  }
+
+  mutex_lock(mutex);
+  if (++finished == NODES)
+    semaphore_V(done);
+  mutex_unlock(mutex);
+
+  return 0;
+}
+
+int bench(int* arg) {
+  uint64_t start;
+  int i;
+
+  mutex = mutex_create();
+  done = semaphore_create();
+  semaphore_initialize(done, 0);
+
+  start = currentTimeMillis();
+  for (i = 0; i < ROUNDS; i++) {
+    finished = 0;
+    minithread_fork(node, (int *) DEPTH);
+    semaphore_P(done);
+  }
+
+  /* hand the elapsed time back to the parent through the pipe */
+  i = (int) (currentTimeMillis() - start);
+  write(result, &i, sizeof(i));
+  exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+  int workers;
+  int elapsed;
+  int baseline = 0;
+  int failed = 0;
+  int fds[2];
+  int status;
+  int w;
+
+  workers = argc > 1 ? atoi(argv[1]) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers < 1)
+    workers = 1;
+
+  printf("%d trees of %d minithreads\n", ROUNDS, NODES);
+  printf("workers  ms  speedup\n");
+  for (w = 1; w <= workers; w++) {
+    if (pipe(fds) != 0)
+      return -1;
+    fflush(stdout);
+    if (fork() == 0) {
+      close(fds[0]);
+      result = fds[1];
+      minithread_workers = w;
+      minithread_system_initialize(bench, NULL);
+      return -1;
+    }
+    close(fds[1]);
+    if (read(fds[0], &elapsed, sizeof(elapsed)) != sizeof(elapsed))
+      elapsed = -1;
+    close(fds[0]);
+    if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      elapsed = -1;
+
+    /* a run that died or never reported its time has no speedup */
+    if (elapsed < 0) {
+      printf("%7d failed\n", w);
+      failed++;
+      continue;
+    }
+    if (baseline == 0)
+      baseline = elapsed;
+    if (elapsed > 0)
+      printf("%7d %4d %8.2f\n", w, elapsed, (double) baseline / elapsed);
+    else
+      printf("%7d %4d        -\n", w, elapsed);
+  }
+
+  if (failed > 0) {
+    fprintf(stderr, "%d of %d runs failed\n", failed, workers);
+    return 1;
+  }
+  return 0;
+}
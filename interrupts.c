@@ -8,41 +8,77 @@
 #include <pthread.h>
 #include <ucontext.h>
 #include <semaphore.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
 #include "defs.h"
 #include "interrupts.h"
 #include "interrupts_private.h"
 #include "minithread.h"
 #include "assert.h"
 #include "machineprimitives.h"
+#include "trace.h"
 
 #define MAXEVENTS 64
+#define ALARM_INTERRUPT_TYPE 5
 #define DISK_INTERRUPT_TYPE 4
 #define READ_INTERRUPT_TYPE 3
 #define NETWORK_INTERRUPT_TYPE 2
 #define CLOCK_INTERRUPT_TYPE 1
 #define MAXBUF 1000
+#define FXSAVE_SW_BYTES 464 /* offset of the xsave magic in the fxsave area */
 #define ENABLED 1
 #define DISABLED 0
 
-interrupt_level_t interrupt_level;
 long ticks;
 extern int start();
 extern int end();
 
 /*
- * Virtual processor interrupt level (spl).
+ * Virtual processor interrupt level (spl), one per host thread.
  * Are interrupts enabled? A new interrupt will only be taken when interrupts
- * are enabled.
+ * are enabled. Host threads start out ENABLED and not holding kernel_lock;
+ * minithread_system_initialize and each scheduler worker disable interrupts
+ * before running anything else.
  */
-interrupt_level_t interrupt_level;
+__thread volatile interrupt_level_t interrupt_level = ENABLED;
 
-typedef struct interrupt_t interrupt_t;
-struct interrupt_t {
+/*
+ * Held by whichever host thread has interrupts disabled.
+ */
+int kernel_lock = 0;
+
+/*
+ * Network packets, disk completions and keyboard lines are passed from the
+ * host threads that poll for them to the minithreads through a ring of
+ * events. Any number of host threads append to it without locks: each
+ * slot's sequence number says whether it is free for the append at that
+ * position (seq == position), or holds the event at that position and is
+ * ready to be taken (seq == position + 1). Events are taken only with
+ * interrupts disabled, so one taker at a time.
+ */
+#define EVENT_RING_SIZE 1024 /* must be a power of 2 */
+
+struct interrupt_event {
+  volatile long seq;
   interrupt_handler_t handler;
   void *arg;
 };
 
-static pthread_mutex_t signal_mutex;
+static struct interrupt_event events[EVENT_RING_SIZE];
+static volatile long events_head = 0; /* next position to append at */
+static volatile long events_tail = 0; /* next position to take from */
+
+/*
+ * Set while a signal is on its way to drain the ring, so that only the
+ * first event of a batch sends one.
+ */
+static volatile int events_signalled = 0;
+
+/*
+ * In polled mode, the eventfd written instead of sending the signal.
+ */
+static int events_fd = -1;
 
 #define R8 0
 #define R9 1
@@ -66,20 +102,46 @@ static pthread_mutex_t signal_mutex;
 
 
 interrupt_handler_t mini_clock_handler;
+interrupt_handler_t mini_alarm_handler;
 interrupt_handler_t mini_network_handler;
 interrupt_handler_t mini_read_handler;
 interrupt_handler_t mini_disk_handler;
 
-static volatile int signal_handled = 0;
-
-sem_t interrupt_received_sema;
+__thread volatile int interrupts_parked = 0;
 
 /*
  * atomically sets interrupt level and returns the original
  * interrupt level
  */
 interrupt_level_t set_interrupt_level(interrupt_level_t newlevel) {
-    return swap(&interrupt_level, newlevel);
+    interrupt_level_t oldlevel = interrupt_level;
+    int spins = 0;
+
+    /*
+     * The level is private to this host thread, so plain loads and stores
+     * do: an interrupt taken between them returns with the level it found.
+     */
+    if (newlevel == DISABLED) {
+        /*
+         * disable first: an interrupt taken while waiting for the lock
+         * would try to take it again on top of us.
+         */
+        interrupt_level = DISABLED;
+        if (oldlevel == ENABLED) {
+            while (atomic_test_and_set(&kernel_lock)) {
+                /* the holder may be descheduled, don't burn its timeslice */
+                if (++spins % 100 == 0)
+                    sched_yield();
+            }
+        }
+        return oldlevel;
+    }
+
+    /* likewise, release the lock before interrupts can come in */
+    if (oldlevel == DISABLED)
+        atomic_clear(&kernel_lock);
+    interrupt_level = ENABLED;
+    return oldlevel;
 }
 
 
@@ -95,28 +157,14 @@ interrupt_level_t set_interrupt_level(interrupt_level_t newlevel) {
  * The signals are handled on their own stack to reduce
  * chances of an overrun.
  */
-void
+timer_t
 minithread_clock_init(int period, interrupt_handler_t clock_handler){
-    timer_t timerid;
-    struct sigevent sev;
-    struct itimerspec its;
     struct sigaction sa;
-    stack_t ss;
+    int i;
     mini_clock_handler = clock_handler;
 
-    sem_init(&interrupt_received_sema,0,0);
-
-    ss.ss_sp = malloc(SIGSTKSZ);
-    if (ss.ss_sp == NULL){
-        perror("malloc.");
-        abort();
-    }
-    ss.ss_size = SIGSTKSZ;
-    ss.ss_flags = 0;
-    if (sigaltstack(&ss, NULL) == -1){
-        perror("signal stack");
-        abort();
-    }
+    for (i = 0; i < EVENT_RING_SIZE; i++)
+        events[i].seq = i;
 
     if(DEBUG)
         printf("SIGRTMAX = %d\n",SIGRTMAX);
@@ -131,10 +179,41 @@ minithread_clock_init(int period, interrupt_handler_t clock_handler){
     if (sigaction(SIGRTMAX-1, &sa, NULL) == -1)
         errExit("sigaction");
 
+    return minithread_clock_init_thread(period);
+}
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/*
+ * Give the calling host thread its own signal stack and a timer that
+ * measures its CPU time and signals only it.
+ */
+timer_t
+minithread_clock_init_thread(int period){
+    timer_t timerid;
+    struct sigevent sev;
+    struct itimerspec its;
+    stack_t ss;
+
+    ss.ss_sp = malloc(SIGSTKSZ);
+    if (ss.ss_sp == NULL){
+        perror("malloc.");
+        abort();
+    }
+    ss.ss_size = SIGSTKSZ;
+    ss.ss_flags = 0;
+    if (sigaltstack(&ss, NULL) == -1){
+        perror("signal stack");
+        abort();
+    }
+
     /* Create the timer */
-    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
     sev.sigev_signo = SIGRTMAX-1;
-    sev.sigev_value.sival_ptr = &timerid;
+    sev.sigev_value.sival_int = CLOCK_INTERRUPT_TYPE;
     if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timerid) == -1)
         errExit("timer_create");
 
@@ -146,6 +225,65 @@ minithread_clock_init(int period, interrupt_handler_t clock_handler){
 
     if (timer_settime(timerid, 0, &its, NULL) == -1)
         errExit("timer_settime");
+
+    return timerid;
+}
+
+timer_t
+minithread_alarm_clock_init(interrupt_handler_t alarm_handler){
+    timer_t timerid;
+    struct sigevent sev;
+
+    mini_alarm_handler = alarm_handler;
+
+    /* same signal as the clock, told apart by its value */
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+    sev.sigev_signo = SIGRTMAX-1;
+    sev.sigev_value.sival_int = ALARM_INTERRUPT_TYPE;
+    if (timer_create(CLOCK_MONOTONIC, &sev, &timerid) == -1)
+        errExit("timer_create");
+
+    return timerid;
+}
+
+void
+minithread_alarm_clock_set(timer_t clock, long deadline, long period){
+    struct itimerspec its;
+
+    its.it_value.tv_sec = deadline / 1000000000;
+    its.it_value.tv_nsec = deadline % 1000000000;
+    if (deadline == 0)
+        period = 0;
+    its.it_interval.tv_sec = period / 1000000000;
+    its.it_interval.tv_nsec = period % 1000000000;
+
+    if (timer_settime(clock, TIMER_ABSTIME, &its, NULL) == -1)
+        errExit("timer_settime");
+}
+
+void
+minithread_clock_set(timer_t clock, long delay, long period){
+    struct itimerspec its;
+
+    its.it_value.tv_sec = delay / 1000000000;
+    its.it_value.tv_nsec = delay % 1000000000;
+    if (delay == 0)
+        period = 0;
+    its.it_interval.tv_sec = period / 1000000000;
+    its.it_interval.tv_nsec = period % 1000000000;
+
+    if (timer_settime(clock, 0, &its, NULL) == -1)
+        errExit("timer_settime");
+}
+
+long
+minithread_clock_remaining(timer_t clock){
+    struct itimerspec its;
+
+    if (timer_gettime(clock, &its) == -1)
+        errExit("timer_gettime");
+    return its.it_value.tv_sec * 1000000000L + its.it_value.tv_nsec;
 }
 
 
@@ -167,10 +305,15 @@ handle_interrupt(int sig, siginfo_t *si, ucontext_t *ucontext)
      * calls.
      */
     if(interrupt_level==ENABLED &&
-            eip > (uint64_t)start &&
-            eip < (uint64_t)end){
+            (interrupts_parked ||
+            (eip > (uint64_t)start &&
+            eip < (uint64_t)end))){
 
         unsigned long *newsp;
+
+        /* the idle thread only lets one interrupt through per park */
+        interrupts_parked = 0;
+        TRACE(TRACE_INTERRUPT, sig, 1);
         /*
          * push the return address
          */
@@ -185,6 +328,12 @@ handle_interrupt(int sig, siginfo_t *si, ucontext_t *ucontext)
         if(ucontext->uc_mcontext.fpregs!=0){
             newsp -= sizeof(struct _fpstate)/sizeof(long);
             memcpy(newsp,ucontext->uc_mcontext.fpregs,sizeof(struct _fpstate));
+            /*
+             * only the legacy fxsave area is copied, so drop the xsave
+             * magic; otherwise sigreturn reads extended state past the
+             * copy, off the top of a fresh stack and into a guard page.
+             */
+            ((unsigned int *) newsp)[FXSAVE_SW_BYTES / sizeof(unsigned int)] = 0;
             ucontext->uc_mcontext.fpregs = (void *)newsp;
         }
 
@@ -201,13 +350,16 @@ handle_interrupt(int sig, siginfo_t *si, ucontext_t *ucontext)
          */
         if(sig==SIGRTMAX-2){
             ucontext->uc_mcontext.gregs[RSP]=(unsigned long)newsp;
-            ucontext->uc_mcontext.gregs[RIP]=(unsigned long)((interrupt_t*)si->si_value.sival_ptr)->handler;
-            ucontext->uc_mcontext.gregs[RDI]=(unsigned long)((interrupt_t*)si->si_value.sival_ptr)->arg;
+            ucontext->uc_mcontext.gregs[RIP]=(unsigned long)interrupt_drain;
+            ucontext->uc_mcontext.gregs[RDI]=(unsigned long)0;
             set_interrupt_level(DISABLED);
         }
         else if(sig==SIGRTMAX-1){
             ucontext->uc_mcontext.gregs[RSP]=(unsigned long)newsp;
-            ucontext->uc_mcontext.gregs[RIP]=(unsigned long)mini_clock_handler;
+            if(si->si_value.sival_int==ALARM_INTERRUPT_TYPE)
+                ucontext->uc_mcontext.gregs[RIP]=(unsigned long)mini_alarm_handler;
+            else
+                ucontext->uc_mcontext.gregs[RIP]=(unsigned long)mini_clock_handler;
             ucontext->uc_mcontext.gregs[RDI]=(unsigned long)0;
             if(DEBUG)
                 printf("SP=%p\n",newsp);
@@ -217,46 +369,127 @@ handle_interrupt(int sig, siginfo_t *si, ucontext_t *ucontext)
             fflush(stdout);
             abort();
         }
-        if(sig==SIGRTMAX-2)
-            signal_handled = 1;
     }
-
-    if(sig==SIGRTMAX-2){
-        if(DEBUG)
-            printf("Signal received\n");
-        sem_post(&interrupt_received_sema);
+    else{
+        TRACE(TRACE_INTERRUPT, sig, 0);
+        if(sig==SIGRTMAX-2){
+            /*
+             * Not safe to drain now. Let the next event signal again; until
+             * then the clock handler and the idle thread drain the ring.
+             */
+            if(DEBUG)
+                printf("Signal dropped\n");
+            events_signalled = 0;
+        }
     }
 }
 
-void send_interrupt(int interrupt_type, interrupt_handler_t handler, void* arg){
+/*
+ * Send the signal that drains the event ring, unless one is already on
+ * its way.
+ */
+static void
+signal_events(){
+    uint64_t one = 1;
+
+    if (__sync_lock_test_and_set(&events_signalled, 1) != 0)
+        return;
+    if (events_fd >= 0)
+        write(events_fd, &one, sizeof(one));
+    else
+        while(sigqueue(getpid(),SIGRTMAX-2, (union sigval)0)==-1);
+}
 
-    interrupt_t interrupt;
-    pthread_mutex_lock(&signal_mutex);
-    for (;;){
-        signal_handled = 0;
-
-        interrupt.arg = arg;
-        if(interrupt_type==NETWORK_INTERRUPT_TYPE)
-            interrupt.handler = mini_network_handler;
-        else if(interrupt_type==READ_INTERRUPT_TYPE)
-            interrupt.handler = mini_read_handler;
-        else if(interrupt_type==DISK_INTERRUPT_TYPE)
-            interrupt.handler = mini_disk_handler;
-        else
-            abort();
+/*
+ * Take the oldest event off the ring. Returns 0 if there is none ready.
+ * Interrupts must be disabled.
+ */
+static int
+take_event(interrupt_handler_t *handler, void **arg){
+    long pos = events_tail;
+    struct interrupt_event *e = &events[pos & (EVENT_RING_SIZE - 1)];
+
+    if (e->seq != pos + 1)
+        return 0;
+    *handler = e->handler;
+    *arg = e->arg;
+    __sync_synchronize();
+    /* free the slot for the append one lap later */
+    e->seq = pos + EVENT_RING_SIZE;
+    events_tail = pos + 1;
+    return 1;
+}
+
+int
+interrupt_poll_init(){
+    events_fd = eventfd(0, EFD_NONBLOCK);
+    if (events_fd == -1)
+        errExit("eventfd");
+    return events_fd;
+}
+
+void
+interrupt_poll(){
+    long pos = events_tail;
 
-        /* Repeat if signal is not delivered. */
-        while(sigqueue(getpid(),SIGRTMAX-2, (union sigval)(void*)&interrupt)==-1);
+    if (events_fd >= 0 && events[pos & (EVENT_RING_SIZE - 1)].seq == pos + 1)
+        interrupt_drain();
+}
 
-        /* semaphore_P to wait for main thread signal */
-        sem_wait(&interrupt_received_sema);
+void
+interrupt_drain(){
+    interrupt_handler_t handler;
+    void *arg;
 
-        /* Check if interrupt was handled */
-        if(signal_handled)
-            break;
+    set_interrupt_level(DISABLED);
+    /*
+     * Events appended from here on signal again, so none is left behind
+     * if we find the ring empty just before they are appended.
+     */
+    events_signalled = 0;
+    __sync_synchronize();
 
-        sleep(0);
-        /* resend if necessary */
+    while (take_event(&handler, &arg)){
+        handler(arg);
+        /* handlers may have enabled interrupts */
+        set_interrupt_level(DISABLED);
     }
-    pthread_mutex_unlock(&signal_mutex);
+}
+
+void send_interrupt(int interrupt_type, interrupt_handler_t handler, void* arg){
+    struct interrupt_event *e;
+    long pos;
+    long dif;
+
+    if(interrupt_type==NETWORK_INTERRUPT_TYPE)
+        handler = mini_network_handler;
+    else if(interrupt_type==READ_INTERRUPT_TYPE)
+        handler = mini_read_handler;
+    else if(interrupt_type==DISK_INTERRUPT_TYPE)
+        handler = mini_disk_handler;
+    else
+        abort();
+
+    /* claim the slot at the head of the ring */
+    for (;;){
+        pos = events_head;
+        e = &events[pos & (EVENT_RING_SIZE - 1)];
+        dif = e->seq - pos;
+        if (dif == 0){
+            if (__sync_bool_compare_and_swap(&events_head, pos, pos + 1))
+                break;
+        }
+        else if (dif < 0){
+            /* full: make sure it is being drained, and wait for room */
+            signal_events();
+            sched_yield();
+        }
+    }
+
+    e->handler = handler;
+    e->arg = arg;
+    __sync_synchronize();
+    e->seq = pos + 1;
+
+    signal_events();
 }
@@ -23,6 +23,7 @@
 #define __INTERRUPTS_H__ 1
 
 #include "defs.h"
+#include <time.h>
 
 /* set_interrupt_level(interrupt_level_t level)
  *      Set the interrupt level to newlevel, return the old interrupt level
@@ -57,20 +58,42 @@
  */
 
 typedef int interrupt_level_t;
-extern interrupt_level_t interrupt_level;
+extern __thread volatile interrupt_level_t interrupt_level;
 
 #define DISABLED 0
 #define ENABLED 1
 
 extern interrupt_level_t set_interrupt_level(interrupt_level_t newlevel);
 
+/*
+ * kernel_lock
+ *     Each host thread running minithreads (a scheduler worker, see
+ *     minithread.h) has its own interrupt level. Disabling interrupts also
+ *     takes kernel_lock, and enabling them releases it, so code that runs
+ *     with interrupts disabled excludes every worker, not just its own.
+ *     A worker holds the lock exactly when its interrupt level is DISABLED;
+ *     minithread_switch and the interrupt return path release it when they
+ *     re-enable interrupts.
+ */
+extern int kernel_lock;
+
+/*
+ * interrupts_parked
+ *     Set by an idle thread while it blocks its host thread waiting for an
+ *     interrupt. While set (and interrupts are ENABLED) the next interrupt is
+ *     taken even though the host thread is outside the minithreads code, and
+ *     the flag is cleared again so only that one interrupt is let through.
+ */
+extern __thread volatile int interrupts_parked;
+
 
 /*
  * minithread_clock_init(h,period)
  *     installs a clock interrupt service routine h.  h will be called every
  *     [period] nanoseconds.  interrupts are disabled after
  *     minithread_clock_init finishes.  After you enable interrupts then your
- *     handler will be called automatically on every clock tick.
+ *     handler will be called automatically on every clock tick.  Returns
+ *     the calling host thread's clock, for minithread_clock_set.
  */
 #define NANOSECOND  1
 #define MICROSECOND (1000*NANOSECOND)
@@ -78,7 +101,51 @@ extern interrupt_level_t set_interrupt_level(interrupt_level_t newlevel);
 #define SECOND      (1000*MILLISECOND)
 
 typedef void(*interrupt_handler_t)(void*);
-extern void minithread_clock_init(int period, interrupt_handler_t h);
+extern timer_t minithread_clock_init(int period, interrupt_handler_t h);
+
+/*
+ * minithread_clock_init_thread(period)
+ *     starts a clock of the given period for the calling host thread, which
+ *     ticks with that thread's CPU time and interrupts only it, and returns
+ *     it. The thread that called minithread_clock_init already has one;
+ *     every other scheduler worker calls this once before it runs
+ *     minithreads.
+ */
+extern timer_t minithread_clock_init_thread(int period);
+
+/*
+ * minithread_clock_set(clock,delay,period)
+ *     re-arms clock to interrupt its thread once that thread has run for
+ *     another [delay] nanoseconds, and every [period] nanoseconds after
+ *     that until it is set again. A delay of 0 stops the clock. Any host
+ *     thread may set any clock.
+ */
+extern void minithread_clock_set(timer_t clock, long delay, long period);
+
+/*
+ * minithread_alarm_clock_init(h)
+ *     installs an alarm interrupt service routine h and returns a clock
+ *     for it, which keeps real time (CLOCK_MONOTONIC) rather than CPU
+ *     time and interrupts the calling host thread. The clock starts out
+ *     stopped; see minithread_alarm_clock_set. Call after
+ *     minithread_clock_init.
+ */
+extern timer_t minithread_alarm_clock_init(interrupt_handler_t h);
+
+/*
+ * minithread_alarm_clock_set(clock,deadline,period)
+ *     re-arms an alarm clock to interrupt once CLOCK_MONOTONIC reaches
+ *     [deadline] nanoseconds, and every [period] nanoseconds after that
+ *     until it is set again. A deadline of 0 stops the clock.
+ */
+extern void minithread_alarm_clock_set(timer_t clock, long deadline, long period);
+
+/*
+ * minithread_clock_remaining(clock)
+ *     returns the nanoseconds left before clock next interrupts its thread,
+ *     or 0 if it is stopped.
+ */
+extern long minithread_clock_remaining(timer_t clock);
 
 #endif /* __INTERRUPTS_H__ */
 
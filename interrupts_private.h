@@ -31,6 +31,9 @@ handle_interrupt();
 extern interrupt_handler_t
 mini_clock_handler;
 
+extern interrupt_handler_t
+mini_alarm_handler;
+
 extern interrupt_handler_t
 mini_network_handler;
 
@@ -40,7 +43,35 @@ mini_read_handler;
 extern interrupt_handler_t
 mini_disk_handler;
 
+/*
+ * Queue an interrupt for the minithreads from a host thread. The event is
+ * appended to a ring and handled, along with any others appended before it
+ * is drained, after a single signal.
+ */
 void send_interrupt(int interrupt_type, interrupt_handler_t handler, void* arg);
 
+/*
+ * Run the handlers of all events queued by send_interrupt. Called with the
+ * signal; may also be called by minithreads with interrupts disabled, and
+ * leaves them disabled.
+ */
+extern void interrupt_drain();
+
+/*
+ * Switch to polled mode, in which send_interrupt does not signal the
+ * minithreads but writes to an eventfd, whose descriptor is returned. The
+ * scheduler watches it with epoll while idle, reads it to rearm it and
+ * calls interrupt_drain, and calls interrupt_poll when switching threads.
+ * Must be called before any device is started.
+ */
+extern int interrupt_poll_init();
+
+/*
+ * In polled mode, drain the events queued by send_interrupt if there are
+ * any; otherwise do nothing. Cheap enough to call on every switch.
+ * Interrupts must be disabled.
+ */
+extern void interrupt_poll();
+
 #endif /* __INTERRUPTS_PRIVATE_H__ */
 
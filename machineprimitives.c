@@ -12,6 +12,7 @@
 #include "minithread.h"
 #include "machineprimitives.h"
 #include <sys/mman.h>
+#include <unistd.h>
 
 /*
  * Used to initialize a thread's stack for the first context switch
@@ -46,7 +47,6 @@ struct initial_stack_state
 };
 
 #define STACK_GROWS_DOWN        1
-#define STACKSIZE               (256 * 1024)
 #define STACKALIGN              0xf
 
 /*
@@ -81,6 +81,81 @@ minithread_free_stack(stack_pointer_t stackbase)
     free(stackbase);
 }
 
+/*
+ * Size of the mapping behind a stack of size bytes: the stack rounded up to
+ * whole pages, plus the guard page.
+ */
+static size_t
+stack_mapping_size(int size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    return ((size + page - 1) & ~(page - 1)) + page;
+}
+
+/*
+ * Allocate a new stack of at least size bytes, with a guard page at the end
+ * it grows towards. Returns 1 if the stack is guarded, 0 if it had to come
+ * from the heap instead. A size that is not positive gets no stack, and
+ * *stackbase is set to NULL.
+ */
+int
+minithread_allocate_stack_size(stack_pointer_t *stackbase, stack_pointer_t *stacktop, int size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t length;
+    char *mapping;
+    char *guard;
+    int guarded = 1;
+
+    if (size <= 0) {
+        *stackbase = NULL;
+        return 0;
+    }
+
+    length = stack_mapping_size(size);
+    mapping = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    guard = STACK_GROWS_DOWN ? mapping : mapping + length - page;
+    if (mapping == MAP_FAILED || mprotect(guard, page, PROT_NONE) != 0) {
+      /* Out of mappings (vm.max_map_count); fall back to an unguarded
+         stack on the heap, which doesn't cost one. */
+      if (mapping != MAP_FAILED)
+        munmap(mapping, length);
+      mapping = (char *) malloc(size);
+      length = size;
+      guarded = 0;
+    }
+
+    *stackbase = (stack_pointer_t) mapping;
+    if (!mapping)
+      return 0;
+
+    if (STACK_GROWS_DOWN)
+      /* Stacks grow down from the end of the mapping. Word align
+         (turn off low bits by anding with ~STACKALIGN). */
+      *stacktop = (stack_pointer_t) ((long)(mapping + length - 1) & ~STACKALIGN);
+    else
+      /* Word align (turn off low bits by anding with ~STACKALIGN) */
+      *stacktop = (stack_pointer_t)(((long)mapping + STACKALIGN)&~STACKALIGN);
+
+    return guarded;
+}
+
+/*
+ * Free a stack of the given size.
+ *
+ * The stack cannot be used after this call.
+ */
+void
+minithread_free_stack_size(stack_pointer_t stackbase, int size, int guarded)
+{
+    if (guarded)
+      munmap(stackbase, stack_mapping_size(size));
+    else
+      free(stackbase);
+}
+
 /*
  * See the architecture assembly file.
  */
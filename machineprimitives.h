@@ -45,6 +45,32 @@ extern void minithread_allocate_stack(stack_pointer_t *stackbase,
  */
 extern void minithread_free_stack(stack_pointer_t stackbase);
 
+/*
+ * Default size, in bytes, of a stack from minithread_allocate_stack.
+ */
+#define STACKSIZE               (256 * 1024)
+
+/*
+ * Like minithread_allocate_stack, but the stack holds at least size bytes.
+ *
+ * Stacks are mapped with mmap and sit above a PROT_NONE guard page, so a
+ * thread that overflows its stack faults instead of corrupting whatever is
+ * mapped below it. A guarded stack costs two mappings towards the process
+ * limit (vm.max_map_count); once that runs out, stacks come from the heap
+ * without a guard. Returns 1 for a guarded stack and 0 otherwise; a size that
+ * is not positive gets no stack, and *stackbase is set to NULL.
+ */
+extern int minithread_allocate_stack_size(stack_pointer_t *stackbase,
+                                          stack_pointer_t *stacktop,
+                                          int size);
+
+/*
+ * Frees a stack from minithread_allocate_stack_size, given the size it was
+ * allocated with and whether it was guarded.
+ */
+extern void minithread_free_stack_size(stack_pointer_t stackbase, int size,
+                                       int guarded);
+
 /*
  *  Initialize the stackframe pointed to by *stacktop so that
  *  the thread running off of *stacktop will invoke:
@@ -20,80 +20,121 @@ disk_t disk;
 inode_t inodes;
 unsigned char *free_block_bitmap;
 
-// outstanding_requests and setup_mutexes are used to synchronize loads of inodes. they enforce the property that
-// every inode is loaded before the requests for free blocks are sent to disk
-// 
-// done_mutex is used to ensure that the vital filesystem data structures are initialized before the filesystem initialization 
-// function returns. 
-int outstanding_requests;
-semaphore_t setup_superblock_mutex;
-semaphore_t setup_inode_mutex;
-semaphore_t setup_bitmap_mutex;
-semaphore_t allocate_inode_mutex;
-semaphore_t allocate_block_mutex;
-semaphore_t done_mutex;
+// setup_reads counts completed reads while minifile_setup loads the
+// superblock, inodes and free block bitmap, before any file operation runs.
+// fs_init_mutex is signalled once they are loaded.
+semaphore_t setup_reads;
+rwlock_t metadata_lock; //Guards inodes, free_block_bitmap and the directories
 semaphore_t fs_init_mutex;
+
+// Data blocks are read through blockcache, which holds a struct cached_block
+// for each. blockcache_mutex serializes calls into the cache and guards the
+// loaded and waiters fields of cached blocks. The cache is ARC, so that
+// reading through a big file does not evict the directory and indirect
+// blocks in use.
 blockcache_t blockcache;
+mutex_t blockcache_mutex;
+
+// block_trace, opened if minifile_block_trace is set, gets the number of
+// every data block got from the cache; also guarded by blockcache_mutex
+char *minifile_block_trace = NULL;
+FILE *block_trace;
 
+// Threads waiting for data block i to be read from disk wait on
+// block_mutexes[i]; handle_disk_response signals it when the read completes.
 semaphore_t *block_mutexes;
 
+// Data blocks read from disk by get_data_block and prefetch_data_block,
+// guarded by blockcache_mutex
+long reads_issued;
+
+struct cached_block {
+	char data[DISK_BLOCK_SIZE]; //first, so a pointer to data is one to the block
+	int blockid; //the data block this is
+	int loaded; //0 until the disk read filling data completes
+	int waiters; //threads waiting for that read, including the one that issued it
+};
+
+#define READAHEAD_MIN 4 //blocks read ahead once a file is read sequentially
+#define READAHEAD_MAX 32 //most blocks read ahead of a file's cursor
+
+// Blocks read ahead stay held in blockcache until their reads complete.
+// readahead_queue has them in the order they were read, guarded by
+// blockcache_mutex, and minifile_readahead releases each once it is loaded.
+queue_t readahead_queue;
+semaphore_t readahead_pending;
+
+#define FLUSH_INTERVAL 1000 //milliseconds between write-back flushes
+#define FLUSH_DIRTY_LIMIT 256 //dirty blocks that bring the next flush forward
+
+// In write-back mode, changed data blocks are marked dirty in blockcache,
+// and changed inodes and free block bitmap blocks are flagged here; the
+// flags are guarded by metadata_lock, like what they flag. minifile_flush
+// writes them all, from the flusher thread or minifile_sync.
+int minifile_write_back = 0;
+char *inode_dirty;
+char *bitmap_dirty;
+int dirty_metadata; //inodes and bitmap blocks flagged
+int flush_requested; //set once the flusher is woken early, until it flushes
+semaphore_t flush_wakeup;
+mutex_t flush_mutex; //one flush, or minifile_sync waiting for writes, at a time
+
+// Every write goes through submit_write, which counts it, and
+// handle_disk_response counts it again when it completes. minifile_sync
+// waits on sync_done until writes_completed reaches sync_target, both read
+// and written with interrupts disabled.
+long writes_issued;
+long writes_completed;
+long sync_target;
+semaphore_t sync_done;
+
 void handle_disk_response(void *arg); // forward declaration
 int allocate_block();
 int inode_read(inode_t inode, char *buf, int position, int len);
 void free_inode(inode_t inode);
 void get_data_block(int blockid, char **ret);
+void release_data_block(int blockid);
+int get_indirect_block(inode_t inode, int indirectBlockNum);
 int inode_write(inode_t inode, char *data, int position, int len);
 void disk_update_inode(inode_t inode);
+static void bitmap_changed(int byte);
+int minifile_flusher(int *arg);
+int minifile_readahead(int *arg);
 
-void setup_inode(void *diskarg)
+// disk handler while minifile_setup runs
+void setup_disk_response(void *diskarg)
 {
-	disk_interrupt_arg_t arg = *((disk_interrupt_arg_t *) diskarg);
-	if (arg.reply != DISK_REPLY_OK)
+	disk_interrupt_arg_t *arg = (disk_interrupt_arg_t *) diskarg;
+	if (arg->reply != DISK_REPLY_OK)
 	{
 		printf("Error in disk request, exiting\n");
 		exit(0);
 	}
-	semaphore_P(setup_inode_mutex);
-	outstanding_requests -= 1;
-	if (outstanding_requests == 0)
-		semaphore_V(setup_superblock_mutex);
-	else 
-		semaphore_V(setup_inode_mutex);
+	free(arg);
+	semaphore_V(setup_reads);
 }
 
-void setup_bitmap(void *diskarg)
+// issue count reads of consecutive blocks from first into buf, and wait
+// for all of them
+void setup_read_blocks(int first, int count, char *buf)
 {
-	disk_interrupt_arg_t arg = *((disk_interrupt_arg_t *) diskarg);
-	if (arg.reply != DISK_REPLY_OK)
-	{
-		printf("Error in disk request, exiting\n");
-		exit(0);
-	}
-	semaphore_P(setup_bitmap_mutex);
-	outstanding_requests--;
-	if (outstanding_requests == 0)
-	{
-		semaphore_V(done_mutex);
-	}
-	else
-	{
-		semaphore_V(setup_bitmap_mutex);
-	}
+	int i;
+	for (i = 0; i < count; i++)
+		disk_read_block(&disk, first + i, buf + (i * DISK_BLOCK_SIZE));
+	for (i = 0; i < count; i++)
+		semaphore_P(setup_reads);
 }
 
-void setup_superblock(void *diskarg)
+// loads the filesystem metadata. Runs in its own thread rather than in the
+// disk handler, which must not block.
+int minifile_setup(int *arg)
 {
-	disk_interrupt_arg_t arg = *((disk_interrupt_arg_t *) diskarg);
-	char *buf;
+	char *buf = (char *) arg;
 	int i;
 	printf("Read block 0, initializing superblock\n");
 	
-	if (arg.reply != DISK_REPLY_OK) 
-	{
-		printf("Error in disk request, exiting\n");
-		exit(0);
-	}
-	sBlock = (superblock_t) arg.request.buffer;
+	setup_read_blocks(0, 1, buf);
+	sBlock = (superblock_t) buf;
 	
 	if (sBlock->magicNumber != MAGIC_NUMBER)
 	{
@@ -102,16 +143,10 @@ void setup_superblock(void *diskarg)
 		exit(0);
 	}
 	
-	setup_superblock_mutex = semaphore_create();
-	semaphore_initialize(setup_superblock_mutex, 0);
-	setup_inode_mutex = semaphore_create();
-	semaphore_initialize(setup_inode_mutex, 1);
-	setup_bitmap_mutex = semaphore_create();
-	semaphore_initialize(setup_bitmap_mutex, 1);
 	inodes = (inode_t) malloc(sizeof(struct inode) * sBlock->num_inodes);
 	buf = (char *) malloc(DISK_BLOCK_SIZE * sBlock->num_inodes);
 	
-	if (inodes == NULL) 
+	if (inodes == NULL || buf == NULL) 
 	{
 		printf("Failed to allocate memory for inode table, exiting\n");
 		exit(0);
@@ -124,17 +159,12 @@ void setup_superblock(void *diskarg)
 		semaphore_initialize(block_mutexes[i], 0); 
 	}
 	printf("initializing inodes\n");
-	install_disk_handler(setup_inode);
-	outstanding_requests = sBlock->num_inodes;
-	for (i = 0; i < sBlock->num_inodes; i++)
-	{
-		disk_read_block(&disk, 1 + i, buf + (i * DISK_BLOCK_SIZE));	
-	}
-	semaphore_P(setup_superblock_mutex);	
+	setup_read_blocks(1, sBlock->num_inodes, buf);
 	for (i = 0; i < sBlock->num_inodes; i++)
 	{
 		memcpy(&(inodes[i]), buf + (i * DISK_BLOCK_SIZE), sizeof(struct inode));
 	}
+	free(buf);
 	printf("Initialized inodes, going on to free block bitmap\n");
 	
 	free_block_bitmap = (unsigned char *) malloc(DISK_BLOCK_SIZE * sBlock->num_free_blocks);
@@ -143,28 +173,29 @@ void setup_superblock(void *diskarg)
 		printf("Failed to allocate memory for free block bitmap, exiting\n");
 		exit(0);
 	}
-	install_disk_handler(setup_bitmap);
-	outstanding_requests = sBlock->num_free_blocks;
-	
-	for (i = 0; i < sBlock->num_free_blocks; i++)
-		disk_read_block(&disk, 1 + sBlock->num_inodes + i, (char *) (free_block_bitmap + (DISK_BLOCK_SIZE * i)));
+	setup_read_blocks(1 + sBlock->num_inodes, sBlock->num_free_blocks, (char *) free_block_bitmap);
 	
-	semaphore_P(done_mutex);
 	install_disk_handler(handle_disk_response);
+	if (minifile_write_back)
+	{
+		inode_dirty = (char *) calloc(sBlock->num_inodes, 1);
+		bitmap_dirty = (char *) calloc(sBlock->num_free_blocks, 1);
+		minithread_fork(minifile_flusher, NULL);
+	}
+	minithread_fork(minifile_readahead, NULL);
 	semaphore_V(fs_init_mutex);
+	return 0;
 }
 
+// the caller must hold metadata_lock for writing, as for allocate_block and free_block
 inode_t allocate_inode(inodetype type, int parentDir, char *name) 
 {
 	int i;
 	int j;
-	char *buf;
-	semaphore_P(allocate_inode_mutex);
 	for (i = 1; i < sBlock->num_inodes; i++)
 	{
 		if (inodes[i].free == 1)
 		{
-			buf = (char *) malloc(DISK_BLOCK_SIZE);
 			inodes[i].directblocks[0] = allocate_block();
 			for (j = 1; j < TABLE_SIZE; j++)
 				inodes[i].directblocks[j] = -1;
@@ -176,13 +207,10 @@ inode_t allocate_inode(inodetype type, int parentDir, char *name)
 			memcpy(inodes[i].name, name, strlen(name));
 			inodes[i].parent = parentDir;
 			inodes[i].type = type;
-			semaphore_V(allocate_inode_mutex);
-			memcpy(buf, &(inodes[i]), sizeof(struct inode));
-			disk_write_block(&disk, 1 + i, buf);
+			disk_update_inode(&(inodes[i]));
 			return &(inodes[i]);
 		}
 	}
-	semaphore_V(allocate_inode_mutex);
 	
 	return NULL;
 }
@@ -192,9 +220,6 @@ int allocate_block()
 {
 	int i, j;
 	unsigned char andbyte;
-	char *buf;
-	int targetblock;
-	semaphore_P(allocate_block_mutex);
 	for (i = 0; i < (DISK_BLOCK_SIZE * sBlock->num_free_blocks); i++)
 	{
 		j = 0;
@@ -204,49 +229,67 @@ int allocate_block()
 			if (andbyte & free_block_bitmap[i])
 			{
 				free_block_bitmap[i] &= ~(andbyte);
-				semaphore_V(allocate_block_mutex);
-				buf = (char *) malloc(DISK_BLOCK_SIZE);
-				targetblock = i / DISK_BLOCK_SIZE;
-				memcpy(buf, (free_block_bitmap + (DISK_BLOCK_SIZE * targetblock)), DISK_BLOCK_SIZE);
-				disk_write_block(&disk, sBlock->free_blocks + targetblock, buf);
+				bitmap_changed(i);
 				return (i * 8) + j;
 			}
 			andbyte  = andbyte << 1;
 			j++;
 		}
 	}
-	semaphore_V(allocate_block_mutex);
 	printf("Unable to allocate block, system out of memory\n");
 	
 	return -1;
 }
 
-// mark data block blockid as free. 1 is free.
+// mark data block blockid as free. 1 is free. Whatever the block still
+// has dirty in the cache is dead, so it is marked clean rather than written
+// back; the block can be evicted, or reused once allocated again.
 void free_block(int blockid) 
 {
 	int bitoffset = blockid % 8;
-	int targetblock = blockid / DISK_BLOCK_SIZE;
 	unsigned char orbyte = (0x01 << bitoffset);
-	char *buf = (char *) malloc(DISK_BLOCK_SIZE);
-	semaphore_P(allocate_block_mutex);
 	free_block_bitmap[blockid / 8] |= orbyte;
-	memcpy(buf, (free_block_bitmap + (DISK_BLOCK_SIZE * targetblock)), DISK_BLOCK_SIZE);
-	disk_write_block(&disk, sBlock->free_blocks + targetblock, buf);
-	semaphore_V(allocate_block_mutex);
+	bitmap_changed(blockid / 8);
+	mutex_lock(blockcache_mutex);
+	blockcache_mark_clean(blockcache, blockid);
+	mutex_unlock(blockcache_mutex);
 }
 
 void handle_disk_response(void *arg) 
 {
-	disk_interrupt_arg_t diskarg = *((disk_interrupt_arg_t *) arg);
-	if (diskarg.request.type == DISK_READ)
-		semaphore_V(block_mutexes[diskarg.request.blocknum - sBlock->data_block_start]);
+	disk_interrupt_arg_t *diskarg = (disk_interrupt_arg_t *) arg;
+	if (diskarg->request.type == DISK_READ)
+		semaphore_V(block_mutexes[diskarg->request.blocknum - sBlock->data_block_start]);
+	else if (diskarg->request.type == DISK_WRITE)
+	{
+		// every write is of a buffer of its own, see submit_write
+		free(diskarg->request.buffer);
+		writes_completed++;
+		if (sync_target != 0 && writes_completed >= sync_target)
+		{
+			sync_target = 0;
+			semaphore_V(sync_done);
+		}
+	}
+	free(diskarg);
 }
 
 void minifile_initialize()
 {
 	char *buf;
 	buf = malloc(DISK_BLOCK_SIZE);
-	blockcache = blockcache_new();
+	blockcache = blockcache_create_policy(BLOCKCACHE_DEFAULT_CAPACITY, BLOCKCACHE_ARC);
+	if (minifile_block_trace != NULL && (block_trace = fopen(minifile_block_trace, "w")) == NULL)
+		printf("Could not open block trace %s\n", minifile_block_trace);
+	blockcache_mutex = mutex_create();
+	flush_wakeup = semaphore_create();
+	semaphore_initialize(flush_wakeup, 0);
+	flush_mutex = mutex_create();
+	sync_done = semaphore_create();
+	semaphore_initialize(sync_done, 0);
+	readahead_queue = queue_new();
+	readahead_pending = semaphore_create();
+	semaphore_initialize(readahead_pending, 0);
 	
 	if (access("MINIFILESYSTEM", W_OK) < 0)
 	{
@@ -256,12 +299,9 @@ void minifile_initialize()
 	
 	disk_name = "MINIFILESYSTEM";
 	use_existing_disk = 1;	
-	done_mutex = semaphore_create();	
-	semaphore_initialize(done_mutex, 0);
-	allocate_inode_mutex = semaphore_create();
-	semaphore_initialize(allocate_inode_mutex, 1);
-	allocate_block_mutex = semaphore_create();
-	semaphore_initialize(allocate_block_mutex, 1);
+	setup_reads = semaphore_create();
+	semaphore_initialize(setup_reads, 0);
+	metadata_lock = rwlock_create();
 	fs_init_mutex = semaphore_create();
 	semaphore_initialize(fs_init_mutex, 0);
 	printf("Reading block 0 from disk...\n");
@@ -272,8 +312,18 @@ void minifile_initialize()
 		exit(0);
 	}
 
-	install_disk_handler(setup_superblock);
-	disk_read_block(&disk, 0, buf);	
+	install_disk_handler(setup_disk_response);
+	minithread_fork(minifile_setup, (int *) buf);
+}
+
+// atomically add a reference to inode, for callers holding metadata_lock
+// only for reading
+static void inode_take_reference(inode_t inode)
+{
+	int references;
+	do
+		references = inode->references;
+	while (compare_and_swap(&(inode->references), references, references + 1) != references);
 }
 
 minifile_t minifile_creat(char *filename)
@@ -283,7 +333,7 @@ minifile_t minifile_creat(char *filename)
 	int i;
 	char *validname = strchr(filename, '/');
 	char *entrybuf = (char *) malloc(sizeof(struct directory_entry));
-	minifile_t ret = (minifile_t) malloc(sizeof(struct minifile));
+	minifile_t ret = (minifile_t) calloc(1, sizeof(struct minifile));
 	inode_t newinode;
 	directory_entry_t entry;
 	if (validname != NULL)
@@ -292,6 +342,8 @@ minifile_t minifile_creat(char *filename)
 		return NULL;
 	}
 
+	rwlock_write_lock(metadata_lock);
+
 	if (curdir->type != DIRECTORY)
 		printf("Warning: current directory type is not set to DIRECTORY\n");
 
@@ -304,6 +356,7 @@ minifile_t minifile_creat(char *filename)
 		if (strcmp(entry->name, filename) == 0)
 		{
 			printf("Error: file already exists in current directory\n");
+			rwlock_write_unlock(metadata_lock);
 			return NULL;
 		}
 	} 
@@ -317,6 +370,7 @@ minifile_t minifile_creat(char *filename)
 	ret->position = 0;
 	ret->type = WRITE;
 
+	rwlock_write_unlock(metadata_lock);
 	return ret;
 }
 
@@ -346,8 +400,9 @@ minifile_t minifile_open(char *filename, char *mode)
 		printf("Warning: current directory type is not set to DIRECTORY\n");	
 
 	entrybuf = (char *) malloc(sizeof(struct directory_entry));
-	ret = (minifile_t) malloc(sizeof(struct minifile));
+	ret = (minifile_t) calloc(1, sizeof(struct minifile));
 	
+	rwlock_read_lock(metadata_lock);
 	numentries = curdir->bytesWritten / sizeof(struct directory_entry);	
 	// test if such a file already exists in the current directory
 	for (i = 0; i < numentries; i++)
@@ -360,6 +415,12 @@ minifile_t minifile_open(char *filename, char *mode)
 			break;
 		}
 	} 
+	// opening an existing file only takes a reference to it, which other
+	// readers may be doing at the same time; truncating and creating
+	// files take the lock for writing themselves
+	if (foundinode != 0 && mode[0] != 'w')
+		inode_take_reference(&(inodes[foundinode]));
+	rwlock_read_unlock(metadata_lock);
 
 	if (mode[0] == 'r')
 	{
@@ -373,7 +434,6 @@ minifile_t minifile_open(char *filename, char *mode)
 			ret->type = WRITE;
 			ret->inode = foundinode;
 			ret->position = 0;
-			inodes[ret->inode].references++;
 			return ret;
 		}
 		else
@@ -381,7 +441,6 @@ minifile_t minifile_open(char *filename, char *mode)
 			ret->type = READ;
 			ret->inode = foundinode;
 			ret->position = 0;
-			inodes[ret->inode].references++;
 			return ret;
 		}
 	}
@@ -406,7 +465,6 @@ minifile_t minifile_open(char *filename, char *mode)
 		{
 			// not actually a newinode, heh
 			newinode = &(inodes[foundinode]);
-			newinode->references++;
 			ret->inode = newinode->id;
 			ret->type = APPEND;
 			ret->position = newinode->bytesWritten;
@@ -421,6 +479,14 @@ minifile_t minifile_open(char *filename, char *mode)
 }
 
 
+// return the data block holding block index of inode's file
+static int file_block(inode_t inode, int index)
+{
+	if (index >= TABLE_SIZE)
+		return get_indirect_block(inode, index - TABLE_SIZE);
+	return inode->directblocks[index];
+}
+
 int inode_read(inode_t inode, char *data, int position, int maxlen)
 {
 	int curblock;
@@ -447,22 +513,21 @@ int inode_read(inode_t inode, char *data, int position, int maxlen)
 			break;
 		}	
 
-		if (curblock >= TABLE_SIZE)
-			targetblock = get_indirect_block(inode, curblock - TABLE_SIZE);
-		else
-			targetblock = inode->directblocks[curblock];
-
+		targetblock = file_block(inode, curblock);
 		get_data_block(targetblock, &blockptr);		
 		curblock++;
 		position += (DISK_BLOCK_SIZE - blockoffset);
 		if (amountLeft > DISK_BLOCK_SIZE - blockoffset) 
 		{
 			memcpy(data, blockptr + blockoffset, DISK_BLOCK_SIZE - blockoffset);
+			release_data_block(targetblock);
+			data += (DISK_BLOCK_SIZE - blockoffset);
 			amountLeft -= (DISK_BLOCK_SIZE - blockoffset);
 		}
 		else 
 		{
 			memcpy(data, blockptr + blockoffset, amountLeft);
+			release_data_block(targetblock);
 			break;
 		}
 		blockoffset = 0;
@@ -470,45 +535,414 @@ int inode_read(inode_t inode, char *data, int position, int maxlen)
 	return amountToRead;
 }
 
+// start reading data block blockid into the cache, if it is not there,
+// without waiting for it
+static void prefetch_data_block(int blockid)
+{
+	struct cached_block *block;
+	mutex_lock(blockcache_mutex);
+	if (!blockcache_contains(blockcache, blockid))
+	{
+		block = (struct cached_block *) malloc(sizeof(struct cached_block));
+		block->blockid = blockid;
+		block->loaded = 0;
+		block->waiters = 0;
+		blockcache_prefetch(blockcache, blockid, block);
+		blockcache_hold(blockcache, blockid);
+		disk_read_block(&disk, blockid + sBlock->data_block_start, block->data);
+		reads_issued++;
+		queue_append(readahead_queue, block);
+		semaphore_V(readahead_pending);
+	}
+	mutex_unlock(blockcache_mutex);
+}
+
+// issue the disk reads for a read of len bytes at position in file, all at
+// once rather than one by one as inode_read gets to each block, and for
+// the blocks after them if file is being read sequentially. The first
+// sequential read reads READAHEAD_MIN blocks ahead. Once the reads get
+// within half of that of the end of what was read ahead, the window
+// doubles, up to READAHEAD_MAX, and is filled again; reads elsewhere turn
+// read-ahead off. The caller holds metadata_lock.
+static void read_ahead(minifile_t file, inode_t inode, int position, int len)
+{
+	int first = position / DISK_BLOCK_SIZE;
+	int last;
+	int end;
+	int fileBlocks = (inode->bytesWritten + DISK_BLOCK_SIZE - 1) / DISK_BLOCK_SIZE;
+	int i;
+
+	if (len > inode->bytesWritten - position)
+		len = inode->bytesWritten - position;
+	last = (position + len - 1) / DISK_BLOCK_SIZE;
+
+	if (first == file->nextBlock || first == file->nextBlock - 1)
+	{
+		// already read far enough ahead
+		if (file->readAheadEnd - (last + 1) > file->readAhead / 2)
+		{
+			file->nextBlock = last + 1;
+			return;
+		}
+		if (file->readAhead == 0)
+			file->readAhead = READAHEAD_MIN;
+		else if (file->readAhead < READAHEAD_MAX)
+			file->readAhead *= 2;
+		if (first < file->readAheadEnd)
+			first = file->readAheadEnd;
+	}
+	else
+		file->readAhead = 0;
+
+	end = last + 1 + file->readAhead;
+	if (end > fileBlocks)
+		end = fileBlocks;
+	for (i = first; i < end; i++)
+		prefetch_data_block(file_block(inode, i));
+	file->readAheadEnd = end;
+	file->nextBlock = last + 1;
+}
+
 int minifile_read(minifile_t file, char *data, int maxlen)
 {
 	int ret;
 	inode_t inode = &(inodes[file->inode]);	
 	
+	rwlock_read_lock(metadata_lock);
 	if (file->position >= inode->bytesWritten)
+	{
+		rwlock_read_unlock(metadata_lock);
 		return 0;
+	}
 
+	read_ahead(file, inode, file->position, maxlen);
 	ret = inode_read(inode, data, file->position, maxlen);
+	rwlock_read_unlock(metadata_lock);
 	file->position += ret;
 	return ret;
 }
 
+// wait for the disk read filling block, which the caller holds, to
+// complete. blockcache_mutex must be held, and is held again on return
+static void wait_for_block(int blockid, struct cached_block *block)
+{
+	block->waiters++;
+	mutex_unlock(blockcache_mutex);
+	semaphore_P(block_mutexes[blockid]);
+	mutex_lock(blockcache_mutex);
+	block->loaded = 1;
+	// handle_disk_response signals once per read, so pass it on to the next
+	// thread waiting for the same read
+	if (--block->waiters > 0)
+		semaphore_V(block_mutexes[blockid]);
+}
+
+// releases each block read ahead once its read completes, so that it can be
+// evicted again
+int minifile_readahead(int *arg)
+{
+	struct cached_block *block;
+	while (1)
+	{
+		semaphore_P(readahead_pending);
+		mutex_lock(blockcache_mutex);
+		queue_dequeue(readahead_queue, (void **) &block);
+		if (!block->loaded)
+			wait_for_block(block->blockid, block);
+		blockcache_release(blockcache, block->blockid);
+		mutex_unlock(blockcache_mutex);
+	}
+	return 0;
+}
+
+// get data block blockid from the cache, reading it from disk on a miss.
+// Threads missing on the same block at once share a single read. The block
+// is held in the cache until the caller is done with it and calls
+// release_data_block.
 void get_data_block(int blockid, char **ret) 
 {
-	char *mem;
-	if (blockcache_get(blockcache, blockid, (void **) ret) >= 0)
-		return;
-	
+	struct cached_block *block;
+	mutex_lock(blockcache_mutex);
+	if (block_trace != NULL)
+		fprintf(block_trace, "%d\n", blockid);
+	if (blockcache_get(blockcache, blockid, (void **) &block) < 0)
+	{
+		block = (struct cached_block *) malloc(sizeof(struct cached_block));
+		block->blockid = blockid;
+		block->loaded = 0;
+		block->waiters = 0;
+		blockcache_insert(blockcache, blockid, block);
+		disk_read_block(&disk, blockid + sBlock->data_block_start, block->data);
+		reads_issued++;
+	}
+	blockcache_hold(blockcache, blockid);
+	if (!block->loaded)
+		wait_for_block(blockid, block);
+	mutex_unlock(blockcache_mutex);
+	*ret = block->data;
+}
+
+// get newly allocated data block blockid, zeroed instead of read from disk,
+// and held as by get_data_block
+void get_new_data_block(int blockid, char **ret) 
+{
+	struct cached_block *block;
+	mutex_lock(blockcache_mutex);
+	if (block_trace != NULL)
+		fprintf(block_trace, "%d\n", blockid);
+	if (blockcache_hold(blockcache, blockid) < 0)
+	{
+		block = (struct cached_block *) malloc(sizeof(struct cached_block));
+		block->blockid = blockid;
+		block->loaded = 1;
+		block->waiters = 0;
+		blockcache_insert(blockcache, blockid, block);
+		blockcache_hold(blockcache, blockid);
+	}
 	else
 	{
-		mem = (char *) malloc(DISK_BLOCK_SIZE);
-		disk_read_block(&disk, blockid + sBlock->data_block_start, mem);
-		*ret = mem;
-		semaphore_P(block_mutexes[blockid]);
+		blockcache_get(blockcache, blockid, (void **) &block);
+		// still being read for the block's previous owner
+		if (!block->loaded)
+			wait_for_block(blockid, block);
+	}
+	memset(block->data, 0, DISK_BLOCK_SIZE);
+	mutex_unlock(blockcache_mutex);
+	*ret = block->data;
+}
+
+// let the cache evict data block blockid again
+void release_data_block(int blockid) 
+{
+	mutex_lock(blockcache_mutex);
+	blockcache_release(blockcache, blockid);
+	mutex_unlock(blockcache_mutex);
+}
+
+// write buf, a buffer of its own that handle_disk_response frees, to disk
+// block blocknum
+static void submit_write(int blocknum, char *buf)
+{
+	__sync_fetch_and_add(&writes_issued, 1);
+	disk_write_block(&disk, blocknum, buf);
+}
+
+// return a block sized copy of len bytes of data, padded with zeroes, for
+// the disk to write from while data changes
+static char *copy_block(char *data, int len)
+{
+	char *buf = (char *) calloc(1, DISK_BLOCK_SIZE);
+	memcpy(buf, data, len);
+	return buf;
+}
+
+// wake the flusher early if enough is dirty. The counts are read without
+// locks: a late wakeup only means a flush at the usual time
+static void flush_if_over_limit()
+{
+	if (!flush_requested &&
+		dirty_metadata + blockcache_dirty_length(blockcache) >= FLUSH_DIRTY_LIMIT)
+	{
+		flush_requested = 1;
+		semaphore_V(flush_wakeup);
 	}
 }
 
+// the contents of data block blockid, held by the caller, changed to data.
+// Written to disk now, or marked dirty in write-back mode. The disk writes
+// from a copy, so the cached block can change or be evicted while the
+// write is outstanding
+void write_data_block(int blockid, char *data) 
+{
+	if (minifile_write_back)
+	{
+		mutex_lock(blockcache_mutex);
+		blockcache_mark_dirty(blockcache, blockid);
+		mutex_unlock(blockcache_mutex);
+		flush_if_over_limit();
+		return;
+	}
+	submit_write(blockid + sBlock->data_block_start, copy_block(data, DISK_BLOCK_SIZE));
+}
+
+// byte of the free block bitmap changed; the caller holds metadata_lock for
+// writing
+static void bitmap_changed(int byte)
+{
+	int targetblock = byte / DISK_BLOCK_SIZE;
+	if (minifile_write_back)
+	{
+		if (!bitmap_dirty[targetblock])
+		{
+			bitmap_dirty[targetblock] = 1;
+			dirty_metadata++;
+			flush_if_over_limit();
+		}
+		return;
+	}
+	submit_write(sBlock->free_blocks + targetblock,
+		copy_block((char *) free_block_bitmap + (DISK_BLOCK_SIZE * targetblock), DISK_BLOCK_SIZE));
+}
+
+// wait until writes_completed reaches target. The caller holds flush_mutex,
+// so it is the only one waiting on sync_done
+static void wait_for_writes(long target)
+{
+	interrupt_level_t previousLevel;
+
+	previousLevel = set_interrupt_level(DISABLED);
+	if (writes_completed < target)
+	{
+		sync_target = target;
+		semaphore_P(sync_done);
+	}
+	set_interrupt_level(previousLevel);
+}
+
+// write every dirty data block, bitmap block and inode to disk. The data
+// writes complete before the metadata is written, so the inodes on disk
+// never point at blocks whose contents are still only in memory. Repeated
+// changes to a block are written once
+static void minifile_flush()
+{
+	struct cached_block *block;
+	int blockid;
+	int dataWritten = 0;
+	int i;
+	mutex_lock(flush_mutex);
+	// keeps writers from changing blocks while they are copied
+	rwlock_read_lock(metadata_lock);
+
+	mutex_lock(blockcache_mutex);
+	while (blockcache_next_dirty(blockcache, &blockid, (void **) &block) == 0)
+	{
+		submit_write(blockid + sBlock->data_block_start, copy_block(block->data, DISK_BLOCK_SIZE));
+		blockcache_mark_clean(blockcache, blockid);
+		dataWritten = 1;
+	}
+	mutex_unlock(blockcache_mutex);
+
+	if (minifile_write_back)
+	{
+		if (dataWritten && dirty_metadata > 0)
+			wait_for_writes(writes_issued);
+		for (i = 0; i < sBlock->num_free_blocks; i++)
+		{
+			if (bitmap_dirty[i])
+			{
+				submit_write(sBlock->free_blocks + i,
+					copy_block((char *) free_block_bitmap + (DISK_BLOCK_SIZE * i), DISK_BLOCK_SIZE));
+				bitmap_dirty[i] = 0;
+			}
+		}
+		for (i = 0; i < sBlock->num_inodes; i++)
+		{
+			if (inode_dirty[i])
+			{
+				submit_write(1 + i, copy_block((char *) &(inodes[i]), sizeof(struct inode)));
+				inode_dirty[i] = 0;
+			}
+		}
+		dirty_metadata = 0;
+	}
+	flush_requested = 0;
+
+	rwlock_read_unlock(metadata_lock);
+	mutex_unlock(flush_mutex);
+}
+
+// writes back what is dirty every FLUSH_INTERVAL milliseconds, or as soon
+// as FLUSH_DIRTY_LIMIT blocks are
+int minifile_flusher(int *arg)
+{
+	while (1)
+	{
+		semaphore_P_timeout(flush_wakeup, FLUSH_INTERVAL);
+		minifile_flush();
+	}
+	return 0;
+}
+
+int minifile_sync(void)
+{
+	long target;
+
+	if (sBlock == NULL)
+		return -1;
+
+	minifile_flush();
+	target = writes_issued;
+
+	mutex_lock(flush_mutex);
+	wait_for_writes(target);
+	mutex_unlock(flush_mutex);
+
+	mutex_lock(blockcache_mutex);
+	if (block_trace != NULL)
+		fflush(block_trace);
+	mutex_unlock(blockcache_mutex);
+	return 0;
+}
+
+void minifile_stats(minifile_stats_t *stats)
+{
+	interrupt_level_t previousLevel;
+
+	previousLevel = set_interrupt_level(DISABLED);
+	stats->writesIssued = writes_issued;
+	stats->writesCompleted = writes_completed;
+	set_interrupt_level(previousLevel);
+
+	mutex_lock(blockcache_mutex);
+	stats->readsIssued = reads_issued;
+	stats->cachedBlocks = blockcache_length(blockcache);
+	stats->dirtyBlocks = blockcache_dirty_length(blockcache);
+	blockcache_stats(blockcache, &stats->cacheHits, &stats->cacheMisses, &stats->cacheEvictions);
+	mutex_unlock(blockcache_mutex);
+}
+
+int minifile_drop_cache(int capacity)
+{
+	blockcache_t old;
+	struct cached_block *block;
+
+	if (sBlock == NULL || capacity <= 0)
+		return -1;
+
+	minifile_sync();
+	mutex_lock(blockcache_mutex);
+	// blocks read ahead are released from the cache they went into
+	while (queue_length(readahead_queue) > 0)
+	{
+		mutex_unlock(blockcache_mutex);
+		minithread_yield();
+		mutex_lock(blockcache_mutex);
+	}
+	old = blockcache;
+	blockcache = blockcache_create_policy(capacity, BLOCKCACHE_ARC);
+	// synced and released, every block comes out; writes in flight have
+	// buffers of their own
+	while (blockcache_dequeue(old, (void **) &block) == 0)
+		free(block);
+	blockcache_free(old);
+	mutex_unlock(blockcache_mutex);
+	return 0;
+}
+
 int get_indirect_block(inode_t inode, int indirectBlockNum)
 {
 	char *buf;
 	indirectblock_t indirect;
+	int blockid;
 	
 	if (inode->indirectblock < 0)
 		inode->indirectblock = allocate_block();
 	
 	get_data_block(inode->indirectblock, &buf);
 	indirect = (indirectblock_t) buf;	
-	return indirect->blocks[indirectBlockNum];
+	blockid = indirect->blocks[indirectBlockNum];
+	release_data_block(inode->indirectblock);
+	return blockid;
 }
 
 void allocate_indirect_block(inode_t inode)
@@ -517,12 +951,17 @@ void allocate_indirect_block(inode_t inode)
 	char *buf;
 	
 	if (inode->indirectblock < 0)
+	{
 		inode->indirectblock = allocate_block();
+		get_new_data_block(inode->indirectblock, &buf);
+	}
+	else
+		get_data_block(inode->indirectblock, &buf);
 
-	get_data_block(inode->indirectblock, &buf);
 	indirect = (indirectblock_t) buf;
 	indirect->blocks[inode->size - TABLE_SIZE] = allocate_block();
-	disk_write_block(&disk, inode->indirectblock + sBlock->data_block_start, buf);
+	write_data_block(inode->indirectblock, buf);
+	release_data_block(inode->indirectblock);
 }
 
 void free_indirectblocks(int indirectBlockNum, int numBlocks)
@@ -536,56 +975,57 @@ void free_indirectblocks(int indirectBlockNum, int numBlocks)
 	{
 		free_block(indirect->blocks[i]);
 	}	
+	release_data_block(indirectBlockNum);
 }
 
+// writes go through the cache, so later reads see them without going to disk
 int inode_write(inode_t inode, char *data, int position, int len)
 {
 	int currentblock = position / DISK_BLOCK_SIZE;
 	int offset = position % DISK_BLOCK_SIZE;
 	int amountRemaining = len;
 	char *buf;
-	int targetblock;
+	int blockid;
+	int fresh;
+	int amount;
 	while (amountRemaining > 0) {
 		if (currentblock < TABLE_SIZE)
 		{
-			if (inode->directblocks[currentblock] < 0) 
+			fresh = inode->directblocks[currentblock] < 0;
+			if (fresh) 
 			{
 				inode->directblocks[currentblock] = allocate_block();
-				buf = (char *) malloc(DISK_BLOCK_SIZE);
 				inode->size++;
 			}
-			else 
-			{
-				get_data_block(inode->directblocks[currentblock], &buf);
-			}
-			targetblock = inode->directblocks[currentblock] + sBlock->data_block_start;	
+			blockid = inode->directblocks[currentblock];	
 		}
 		else
 		{
-			if (len + (currentblock * DISK_BLOCK_SIZE) + offset >= inode->size * DISK_BLOCK_SIZE)
+			fresh = currentblock >= inode->size;
+			if (fresh)
 			{
 				allocate_indirect_block(inode);
 				inode->size++;
 			}
-			targetblock = get_indirect_block(inode, currentblock - TABLE_SIZE) + sBlock->data_block_start;
-		}
-	
-		if (amountRemaining < DISK_BLOCK_SIZE - offset)
-		{
-			// can fit everything into the current block
-			memcpy(buf + offset, data, amountRemaining);
-			amountRemaining = 0; 
-			disk_write_block(&disk, targetblock, buf);
+			blockid = get_indirect_block(inode, currentblock - TABLE_SIZE);
 		}
+
+		if (fresh)
+			get_new_data_block(blockid, &buf);
 		else
-		{
-			memcpy(buf + offset, data, DISK_BLOCK_SIZE - offset);
-			disk_write_block(&disk, targetblock, buf);
-			data = data + (DISK_BLOCK_SIZE - offset);
-			offset = 0;	
-			currentblock++;
-			amountRemaining -= (DISK_BLOCK_SIZE - offset);
-		}
+			get_data_block(blockid, &buf);
+	
+		amount = DISK_BLOCK_SIZE - offset;
+		if (amountRemaining < amount)
+			amount = amountRemaining;
+		memcpy(buf + offset, data, amount);
+		write_data_block(blockid, buf);
+		release_data_block(blockid);
+
+		data = data + amount;
+		amountRemaining -= amount;
+		offset = 0;	
+		currentblock++;
 	}
 	
 	if (position + len > inode->bytesWritten)
@@ -596,12 +1036,20 @@ int inode_write(inode_t inode, char *data, int position, int len)
 	return len;
 }
 
+// the caller holds metadata_lock for writing
 void disk_update_inode(inode_t inode) 
 {
-	char *buf;
-	buf = (char *) malloc(DISK_BLOCK_SIZE);	
-	memcpy(buf, inode, sizeof(struct inode));
-	disk_write_block(&disk, 1 + inode->id, buf);
+	if (minifile_write_back)
+	{
+		if (!inode_dirty[inode->id])
+		{
+			inode_dirty[inode->id] = 1;
+			dirty_metadata++;
+			flush_if_over_limit();
+		}
+		return;
+	}
+	submit_write(1 + inode->id, copy_block((char *) inode, sizeof(struct inode)));
 }
 
 int minifile_write(minifile_t file, char *data, int len)
@@ -615,7 +1063,9 @@ int minifile_write(minifile_t file, char *data, int len)
 		return -1;
 	}
 
+	rwlock_write_lock(metadata_lock);
 	bytesWritten = inode_write(inode, data, file->position, len);
+	rwlock_write_unlock(metadata_lock);
 	file->position += bytesWritten;
 	
 	return bytesWritten;
@@ -624,7 +1074,8 @@ int minifile_write(minifile_t file, char *data, int len)
 void free_inode(inode_t inode)
 {
 	int i;
-	for (i = 0; i < inode->size; i++)
+	// past TABLE_SIZE, the blocks are in the indirect block
+	for (i = 0; i < inode->size && i < TABLE_SIZE; i++)
 	{
 		free_block(inode->directblocks[i]);	
 		inode->directblocks[i] = -1;
@@ -632,7 +1083,10 @@ void free_inode(inode_t inode)
 	}	
 	
 	if (inode->indirectblock > 0)
+	{
 		free_indirectblocks(inode->indirectblock, inode->size - TABLE_SIZE);
+		free_block(inode->indirectblock);
+	}
 	
 	inode->indirectblock = -1;
 	inode->size = 0;
@@ -646,14 +1100,19 @@ int minifile_close(minifile_t file)
 {
 	inode_t inode = &(inodes[file->inode]);
 	
+	rwlock_write_lock(metadata_lock);
 	if (inode->free == 1)
+	{
+		rwlock_write_unlock(metadata_lock);
 		return -1;
+	}
 
 	inode->references--;
 	
 	if (inode->references == 0) 
 		free_inode(inode);
 
+	rwlock_write_unlock(metadata_lock);
 	return 0;	
 }
 
@@ -666,6 +1125,7 @@ int minifile_unlink(char *filename)
 	int numentries;
 	inode_t curdir = &(inodes[runningThread->currentDirectoryInode]);	
 	directory_entry_t entry;
+	rwlock_write_lock(metadata_lock);
 	numentries = curdir->bytesWritten / sizeof(struct directory_entry);	
 	// test if such a file already exists in the current directory
 	for (i = 0; i < numentries; i++)
@@ -683,6 +1143,7 @@ int minifile_unlink(char *filename)
 		if (inodes[entry->inode_num].type != REGULARFILE)
 		{
 			printf("Error: unlink target is not a regular file\n");
+			rwlock_write_unlock(metadata_lock);
 			return -1;
 		}
 		for (i += 1; i < numentries; i++)
@@ -696,8 +1157,10 @@ int minifile_unlink(char *filename)
 		if (inodes[entry->inode_num].references == 0)
 			free_inode(&(inodes[entry->inode_num]));
 		
+		rwlock_write_unlock(metadata_lock);
 		return 0;
 	}
+	rwlock_write_unlock(metadata_lock);
 	printf("No such file exists\n");
 	return -1;
 }
@@ -717,6 +1180,8 @@ int minifile_mkdir(char *dirname)
 		return -1;
 	}
 
+	rwlock_write_lock(metadata_lock);
+
 	if (curdir->type != DIRECTORY)
 		printf("Warning: current directory type is not set to DIRECTORY\n");
 
@@ -731,6 +1196,7 @@ int minifile_mkdir(char *dirname)
 		if (strcmp(entry->name, dirname) == 0)
 		{
 			printf("Error: file or directory already exists with that name in current directory\n");
+			rwlock_write_unlock(metadata_lock);
 			return -1;
 		}
 	} 
@@ -741,6 +1207,7 @@ int minifile_mkdir(char *dirname)
 	strcpy(entry->name, dirname);
 	entry->inode_num = newinode->id;
 	inode_write(curdir, entrybuf, curdir->bytesWritten, sizeof(struct directory_entry)); 
+	rwlock_write_unlock(metadata_lock);
 	return 0;
 }
 
@@ -763,6 +1230,8 @@ int minifile_rmdir(char *dirname)
 		return -1;
 	}
 
+	rwlock_write_lock(metadata_lock);
+
 	if (curdir->type != DIRECTORY)
 		printf("Warning: current directory type is not set to DIRECTORY\n");
 
@@ -784,6 +1253,7 @@ int minifile_rmdir(char *dirname)
 		if (rmdir->type != DIRECTORY)
 		{
 			printf("rmdir target is not a directory\n");
+			rwlock_write_unlock(metadata_lock);
 			return -1;
 		}
 		
@@ -799,18 +1269,22 @@ int minifile_rmdir(char *dirname)
 		}	
 		
 		curdir->bytesWritten -= sizeof(struct directory_entry);
+		rwlock_write_unlock(metadata_lock);
 		return 0;	
 	}
 	else 
 	{
+		rwlock_write_unlock(metadata_lock);
 		printf("rmdir target not found\n");
 		return -1;
 	}
 }
 
+// the caller must hold metadata_lock, as for resolve_pathname
 inode_t find(char *path, inode_t curdir) 
 {
 	char *next;
+	char *saveptr;
 	char *entrybuf;
 	int numentries;
 	directory_entry_t entry;
@@ -818,7 +1292,8 @@ inode_t find(char *path, inode_t curdir)
 	int len = strlen(path);
 	int found;
 	entrybuf = (char *) malloc(sizeof(struct directory_entry));
-	while ((next = strtok(path, "/")) != NULL)
+	// readers resolve paths concurrently, so strtok's hidden state won't do
+	while ((next = strtok_r(path, "/", &saveptr)) != NULL)
 	{
 		numentries = curdir->bytesWritten / sizeof(struct directory_entry);	
 		path = NULL;
@@ -890,9 +1365,12 @@ inode_t resolve_pathname(char *path)
 int minifile_stat(char *path)
 {
 	inode_t target; 
+	int bytesWritten;
+	rwlock_read_lock(metadata_lock);
 	target = resolve_pathname(path);
 	if (target == NULL)
 	{
+		rwlock_read_unlock(metadata_lock);
 		printf("File not found\n");
 		return -1;
 	}
@@ -900,29 +1378,35 @@ int minifile_stat(char *path)
 	{
 		printf("Stats for file %s: \n", target->name);
 		printf("Type: %d, bytes written: %d, blocks allocated: %d\n", target->type, target->bytesWritten, target->size);
-		return target->bytesWritten;
+		bytesWritten = target->bytesWritten;
+		rwlock_read_unlock(metadata_lock);
+		return bytesWritten;
 	}
 } 
 
 int minifile_cd(char *path)
 {
 	inode_t target; 
+	rwlock_read_lock(metadata_lock);
 	target = resolve_pathname(path);
 	
 	if (target == NULL)
 	{
+		rwlock_read_unlock(metadata_lock);
 		printf("Error: cd target not found\n");
 		return -1;
 	}
 	
 	if (target->type != DIRECTORY) 
 	{
+		rwlock_read_unlock(metadata_lock);
 		printf("Error: cd target is not a directory\n");
 		return -1;
 	}	
 	
 	runningThread->currentDirectoryInode = target->id;
 	
+	rwlock_read_unlock(metadata_lock);
 	return 0;
 }
 
@@ -934,16 +1418,19 @@ char **minifile_ls(char *path)
 	char *entrybuf;
 	directory_entry_t entry;
 	char **ret;
+	rwlock_read_lock(metadata_lock);
 	target = resolve_pathname(path);
 	
 	if (target == NULL)
 	{
+		rwlock_read_unlock(metadata_lock);
 		printf("Error: ls target not found\n");
 		return NULL;
 	}
 	
 	if (target->type != DIRECTORY) 
 	{
+		rwlock_read_unlock(metadata_lock);
 		printf("Error: cd target is not a directory\n");
 		return NULL;
 	}
@@ -951,7 +1438,10 @@ char **minifile_ls(char *path)
 	numentries = target->bytesWritten / sizeof(struct directory_entry);	
 	
 	if (numentries == 0)
+	{
+		rwlock_read_unlock(metadata_lock);
 		return NULL;
+	}
 	
 	entrybuf = (char *) malloc(sizeof(struct directory_entry));
 	ret = (char **) malloc(sizeof(char *) * (numentries + 1));
@@ -966,6 +1456,7 @@ char **minifile_ls(char *path)
 	
 	ret[i] = NULL;
 	
+	rwlock_read_unlock(metadata_lock);
 	return ret;
 }
 
@@ -983,6 +1474,7 @@ char* minifile_pwd(void)
 	
 	i = 0;
 	
+	rwlock_read_lock(metadata_lock);
 	while (cur != 0)
 	{
 		entries[i] = inodes[cur].name;
@@ -997,6 +1489,7 @@ char* minifile_pwd(void)
 		strcat(ret, entries[i-j]);
 		strcat(ret, "/");
 	}
+	rwlock_read_unlock(metadata_lock);
 	
 	return ret;
 }
@@ -38,6 +38,11 @@ struct minifile {
 	opentype type;
 	int inode;
 	int position;
+	// read-ahead state, all 0 for a file not read yet; see read_ahead in
+	// minifile.c
+	int nextBlock; // the block a sequential read would start in next
+	int readAhead; // blocks to read ahead of the cursor, 0 for none
+	int readAheadEnd; // blocks before this one have been read ahead
 };
 
 struct inode
@@ -85,10 +90,44 @@ struct directory_entry
 	unsigned int inode_num;
 };
 
+/*
+ * Counts of the filesystem's disk traffic and block cache, see minifile_stats.
+ */
+typedef struct minifile_stats
+{
+	long readsIssued; // data blocks read from disk
+	long writesIssued; // blocks written to disk, data or metadata
+	long writesCompleted; // of those, the writes that have completed
+	int cachedBlocks; // data blocks in the cache
+	int dirtyBlocks; // of those, the ones not yet written back
+	long cacheHits; // the block cache's hits, misses and evictions
+	long cacheMisses;
+	long cacheEvictions;
+} minifile_stats_t;
+
 extern semaphore_t fs_init_mutex;
 extern char* current_directory;
+
 extern superblock_t sblock;
 
+/*
+ * Set to 1 before calling minithread_system_initialize to cache writes:
+ * changed data blocks, inodes and free block bitmap blocks stay in memory
+ * and a flusher thread writes them back every second, or sooner once
+ * enough of them are dirty, each once however often it changed. Until
+ * then a crash loses them; minifile_sync makes them durable. Defaults to
+ * 0, writing through to disk on every change.
+ */
+extern int minifile_write_back;
+
+/*
+ * Set to a file name before calling minithread_system_initialize to record
+ * the number of every data block read or written, one per line, in that
+ * file. cachesim replays it to compare block cache policies. The file is
+ * flushed by minifile_sync.
+ */
+extern char *minifile_block_trace;
+
 /* 
  * General requiremens:
  *     If filenames and/or dirnames begin with a "/" they are absolute
@@ -190,5 +229,26 @@ char **minifile_ls(char *path);
  */
 char* minifile_pwd(void);
 
+/*
+ * Write everything cached and not yet on disk, and wait until all writes
+ * issued so far, by anyone, have completed. Returns 0, or -1 if there is
+ * no filesystem.
+ */
+int minifile_sync(void);
+
+/*
+ * Fill in stats with the filesystem's counts so far. The cache's counts
+ * start again at 0 whenever minifile_drop_cache replaces it.
+ */
+void minifile_stats(minifile_stats_t *stats);
+
+/*
+ * Sync, then replace the block cache with an empty one of capacity blocks,
+ * so that what is read next comes from disk. No other thread may be using
+ * files meanwhile. Returns 0, or -1 if there is no filesystem or capacity
+ * is not positive.
+ */
+int minifile_drop_cache(int capacity);
+
 
 #endif /* __MINIFILE_H__ */
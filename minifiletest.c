@@ -0,0 +1,217 @@
+/* minifiletest.c
+
+   Tests of reading and writing minifiles through the block cache. Each
+   failure is printed, and the exit status is the number of failures.
+   Needs a file system made by mkfs, in MINIFILESYSTEM; it writes a file
+   named minifiletest.
+*/
+
+#include "minithread.h"
+#include "synch.h"
+#include "minifile.h"
+#include "blockcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WORKERS 4
+
+#define NAME "minifiletest"
+#define FILE_BLOCKS 100
+#define FILE_SIZE (FILE_BLOCKS * DISK_BLOCK_SIZE - 100)
+/* bytes written and read at a time, not a multiple of the block size */
+#define CHUNK 3000
+
+/* threads reading the file at once */
+#define READERS 8
+/* blocks in the cache evicted from under them */
+#define TINY_CACHE 3
+/* most misses a sequential read may take: reading ahead, only the blocks
+   found before the file's data (its directory's and its indirect block)
+   should miss */
+#define SEQUENTIAL_MISSES 2
+
+semaphore_t finished;
+int failures = 0;
+
+char data[FILE_SIZE];
+int badReads;
+
+void fail(char* test, char* what) {
+  printf("%s test failed: %s\n", test, what);
+  failures++;
+}
+
+/* wait for count threads to V finished */
+void join(int count) {
+  while (count-- > 0)
+    semaphore_P(finished);
+}
+
+/* empty minifile's cache, so that what is read next comes from disk */
+void cold_cache(int capacity) {
+  if (minifile_drop_cache(capacity) != 0)
+    fail("Setup", "minifile_drop_cache failed");
+}
+
+/* reads the whole file in chunks and checks it is data */
+int reader(int* arg) {
+  char* back = (char *) malloc(FILE_SIZE);
+  minifile_t file = minifile_open(NAME, "r");
+  int got = 0;
+  int n;
+
+  while (file != NULL && (n = minifile_read(file, back + got, CHUNK)) > 0)
+    got += n;
+  if (got != FILE_SIZE || memcmp(back, data, FILE_SIZE) != 0)
+    __sync_add_and_fetch(&badReads, 1);
+  if (file != NULL)
+    minifile_close(file);
+  free(back);
+
+  semaphore_V(finished);
+  return 0;
+}
+
+/* run READERS readers at once, and report whether they all read data */
+int read_together() {
+  int i;
+
+  badReads = 0;
+  for (i = 0; i < READERS; i++)
+    minithread_fork(reader, NULL);
+  join(READERS);
+  return badReads == 0;
+}
+
+/* (re)write the file with data that differs for each seed */
+void write_file(int seed) {
+  minifile_t file;
+  int i;
+
+  for (i = 0; i < FILE_SIZE; i++)
+    data[i] = 'a' + (i * 7 + i / DISK_BLOCK_SIZE + seed) % 26;
+  minifile_unlink(NAME);
+  file = minifile_creat(NAME);
+  if (file == NULL) {
+    fail("Write", "could not create " NAME);
+    return;
+  }
+  for (i = 0; i < FILE_SIZE; i += CHUNK)
+    if (minifile_write(file, data + i, FILE_SIZE - i < CHUNK ? FILE_SIZE - i : CHUNK) < 0) {
+      fail("Write", "a write failed");
+      break;
+    }
+  minifile_close(file);
+}
+
+void test_cold_readers() {
+  minifile_stats_t stats;
+  long reads;
+
+  /* threads missing on the same block at once share one read of it, so
+     each block is read from disk once and cached once */
+  cold_cache(BLOCKCACHE_DEFAULT_CAPACITY);
+  minifile_stats(&stats);
+  reads = stats.readsIssued;
+  if (!read_together())
+    fail("Cold cache", "readers read the wrong data");
+  minifile_stats(&stats);
+  if (stats.readsIssued - reads != stats.cachedBlocks)
+    fail("Cold cache", "a block was read from disk more than once");
+  if (stats.cachedBlocks < FILE_BLOCKS)
+    fail("Cold cache", "the file's blocks were not all cached");
+}
+
+void test_tiny_cache() {
+  minifile_stats_t stats;
+
+  cold_cache(TINY_CACHE);
+  if (!read_together())
+    fail("Tiny cache", "readers read the wrong data");
+  minifile_stats(&stats);
+  if (stats.cacheEvictions == 0)
+    fail("Tiny cache", "nothing was evicted");
+}
+
+void test_write_back() {
+  minifile_stats_t stats;
+
+  /* the new contents stay in the cache until synced */
+  write_file(1);
+  minifile_stats(&stats);
+  if (stats.dirtyBlocks == 0)
+    fail("Write-back", "written blocks were not left dirty in the cache");
+  if (minifile_sync() != 0)
+    fail("Write-back", "minifile_sync failed");
+  minifile_stats(&stats);
+  if (stats.dirtyBlocks != 0)
+    fail("Write-back", "blocks were still dirty after minifile_sync");
+  if (stats.writesCompleted < stats.writesIssued)
+    fail("Write-back", "minifile_sync returned before its writes completed");
+
+  /* and are read back from disk */
+  cold_cache(BLOCKCACHE_DEFAULT_CAPACITY);
+  if (!read_together())
+    fail("Write-back", "readers did not read back what was synced");
+}
+
+void test_sequential() {
+  minifile_stats_t stats;
+  long reads;
+
+  cold_cache(BLOCKCACHE_DEFAULT_CAPACITY);
+  minifile_stats(&stats);
+  reads = stats.readsIssued;
+  badReads = 0;
+  minithread_fork(reader, NULL);
+  join(1);
+  if (badReads != 0)
+    fail("Sequential", "the reader read the wrong data");
+  minifile_stats(&stats);
+  if (stats.cacheMisses > SEQUENTIAL_MISSES)
+    fail("Sequential", "blocks were not read ahead");
+  if (stats.readsIssued - reads != stats.cachedBlocks)
+    fail("Sequential", "a block was read from disk more than once");
+}
+
+void test_unlink() {
+  minifile_stats_t stats;
+
+  /* the blocks of a file unlinked before they were written back are not
+     written at all */
+  write_file(2);
+  minifile_unlink(NAME);
+  minifile_stats(&stats);
+  if (stats.dirtyBlocks >= FILE_BLOCKS)
+    fail("Unlink", "the blocks of an unlinked file were left dirty");
+}
+
+int tests(int* arg) {
+  finished = semaphore_create();
+  semaphore_initialize(finished, 0);
+  semaphore_P(fs_init_mutex);
+  minifile_cd("/");
+
+  write_file(0);
+  test_cold_readers();
+  test_tiny_cache();
+  test_write_back();
+  test_sequential();
+  test_unlink();
+
+  /* leave the file system whole for the next run */
+  minifile_sync();
+  printf("%d failures\n", failures);
+  exit(failures);
+  return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+  minithread_workers = WORKERS;
+  minifile_write_back = 1;
+  minithread_system_initialize(tests, NULL);
+  return -1;
+}
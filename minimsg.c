@@ -273,6 +273,9 @@ int minimsg_receive(miniport_t local_unbound_port, miniport_t* new_local_bound_p
 
 	network_interrupt_arg_t* incoming_data;
 
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+
 	if (local_unbound_port == NULL)
 		return 0;
 
@@ -283,7 +286,9 @@ int minimsg_receive(miniport_t local_unbound_port, miniport_t* new_local_bound_p
 		return 0;
 
 	semaphore_P(local_unbound_port->port_data.unbound.data_available);
+	previousLevel = set_interrupt_level(DISABLED);
 	queue_dequeue(local_unbound_port->port_data.unbound.data_queue, (void**) &incoming_data);
+	set_interrupt_level(previousLevel);
 
 	header = (mini_header_t) ((char*) incoming_data->buffer + sizeof(struct mini_header));
 
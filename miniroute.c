@@ -11,15 +11,14 @@ int route_request_id;
 int route_requests_index;
 int pkt_id;
 
-semaphore_t route_cache_semaphore; //Controls acces to route cache
-semaphore_t request_id_semaphore; //Controls access to route_request_id
+mutex_t route_cache_mutex; //Controls acces to route cache
+mutex_t request_id_mutex; //Controls access to route_request_id
 semaphore_t cached_route_semaphore;
 
 // forward declaration
 void purge_route_cache(void *arg);
 void delete_route_data(route_data_t routeData);
 route_request_t new_route_request();
-void alarm_wakeup_semaphore(void *arg);
 char* merge_headers(routing_header_t route_header, char* header, int header_len);
 network_address_t* miniroute_reverse_raw_path(routing_header_t header, int path_len);
 route_data_t create_route_data(network_address_t* route, int route_len, int time_found);
@@ -43,13 +42,11 @@ void miniroute_initialize()
 	current_discovery_requests = hashmap_new();
 
 
-	route_cache_semaphore = semaphore_create();
-	semaphore_initialize(route_cache_semaphore, 1);
+	route_cache_mutex = mutex_create();
 
-	request_id_semaphore = semaphore_create();
-	semaphore_initialize(request_id_semaphore, 1);
+	request_id_mutex = mutex_create();
 
-	//register_alarm(3000, &purge_route_cache, NULL);
+	//register_periodic_alarm(3000, &purge_route_cache, NULL);
 }
 
 //Removes entries older than 3 seconds route cache
@@ -65,7 +62,7 @@ void purge_route_cache(void* arg)
 
 	hashmap_item_t item = route_cache->first;
 
-	semaphore_P(route_cache_semaphore);
+	mutex_lock(route_cache_mutex);
 
 
 	//Find all entries older than 3 seconds and delete them
@@ -92,10 +89,7 @@ void purge_route_cache(void* arg)
 		else
 			item = NULL;
 	}
-	semaphore_V(route_cache_semaphore);
-
-	//Restart in 3 seconds
-	register_alarm(3000, &purge_route_cache, NULL);
+	mutex_unlock(route_cache_mutex);
 	*/
 }
 
@@ -139,14 +133,13 @@ int miniroute_send_pkt(network_address_t dest_address, int hdr_len, char* hdr, i
 	routing_header_t routingHeader = NULL;
 	char* fullHeader = NULL;
 	routing_header_t tempRoutingHeader;
-	int j;
 	int success = 0;
 	network_address_t destAddr2;
 
 	if (hdr_len == 0 || hdr == NULL || data_len == 0 || data == NULL)
 		return -1;
 
-	semaphore_P(route_cache_semaphore);
+	mutex_lock(route_cache_mutex);
 
 	hashmap_get(route_cache, hash_address(dest_address), (void **) &routeData);
 
@@ -160,34 +153,30 @@ int miniroute_send_pkt(network_address_t dest_address, int hdr_len, char* hdr, i
 
 		if (route == NULL)
 		{
-			semaphore_V(route_cache_semaphore);
+			mutex_unlock(route_cache_mutex);
 			return -1;
 		}
 		memcpy(route, routeData->route, sizeof(network_address_t) * routeLength);
 		routeValid = 1;
 	}
 
-	semaphore_V(route_cache_semaphore);
+	mutex_unlock(route_cache_mutex);
 
 	if (routeValid == 0)
 	{
-		semaphore_P(route_cache_semaphore);
+		mutex_lock(route_cache_mutex);
 		hashmap_get(current_discovery_requests, hash_address(dest_address), (void **) &routeRequest);
 		printf("getting address with id %d\n", hash_address(dest_address));
 
 		if (routeRequest != NULL)
 		{
-			// Bit of a hacky way to enfore mutual exclusion on routeRequest->threads_waiting
-			routeRequest->threads_waiting++;
-			semaphore_V(route_cache_semaphore);
-
-			semaphore_P(routeRequest->waiting_semaphore);
-			semaphore_P(route_cache_semaphore);
+			//Wait for the discovery under way to end, then look again
+			condition_wait(routeRequest->route_found, route_cache_mutex);
 			hashmap_get(route_cache, hash_address(dest_address), (void **) &routeData);
 
 			if (routeData == NULL)
 			{
-				semaphore_V(route_cache_semaphore);
+				mutex_unlock(route_cache_mutex);
 				if (USER_DEBUG)
 					printf("Expected route to be found, none present\n");
 				return -1;
@@ -197,10 +186,10 @@ int miniroute_send_pkt(network_address_t dest_address, int hdr_len, char* hdr, i
 				routeLength = routeData->length;
 
 				ticks = (currentTime - routeData->time_found) * QUANTA / 3;
+				//The entry is still used, so the cache stays locked
 				if (ticks > SECOND)
 				{
-					semaphore_V(route_cache_semaphore);
-					if (USER_DEBUG)	
+					if (USER_DEBUG)
 						printf("route cache entry timed out\n");
 				}
 
@@ -208,12 +197,12 @@ int miniroute_send_pkt(network_address_t dest_address, int hdr_len, char* hdr, i
 
 				if (route == NULL)
 				{
-					semaphore_V(route_cache_semaphore);
+					mutex_unlock(route_cache_mutex);
 					return -1;
 				}
 
 				memcpy(route, routeData->route, sizeof(network_address_t) * routeLength);
-				semaphore_V(route_cache_semaphore);
+				mutex_unlock(route_cache_mutex);
 			}
 		}
 		else
@@ -225,14 +214,13 @@ int miniroute_send_pkt(network_address_t dest_address, int hdr_len, char* hdr, i
 
 			hashmap_insert(current_discovery_requests, hash_address(dest_address), (void *) routeRequest);
 			currentRequestId = route_request_id++;
-			semaphore_V(route_cache_semaphore);
+			mutex_unlock(route_cache_mutex);
 
 			for (i = 0; i < 3; i++)
 			{
-				semaphore_P(request_id_semaphore);
+				mutex_lock(request_id_mutex);
 				currentRequestId = route_request_id++;
-				semaphore_V(request_id_semaphore);
-				register_alarm(12000, &alarm_wakeup_semaphore, (void*) routeRequest->initiator_semaphore);
+				mutex_unlock(request_id_mutex);
 
 				network_get_my_address(myAddr);
 
@@ -257,7 +245,8 @@ int miniroute_send_pkt(network_address_t dest_address, int hdr_len, char* hdr, i
 
 				network_bcast_pkt(sizeof(struct routing_header)+hdr_len, (char*) fullHeader, data_len, data);
 
-				semaphore_P(routeRequest->initiator_semaphore);
+				//Wait up to 12 seconds for a reply before broadcasting again
+				semaphore_P_timeout(routeRequest->initiator_semaphore, 12000);
 
 				if (routeRequest->interrupt_arg != NULL)
 				{
@@ -282,15 +271,15 @@ int miniroute_send_pkt(network_address_t dest_address, int hdr_len, char* hdr, i
 						return -1;
 					}
 
-					semaphore_P(route_cache_semaphore);
+					//Threads only wait on the request while it is listed, so it
+					//can be deleted once it is unlisted and they are woken
+					mutex_lock(route_cache_mutex);
 					hashmap_insert(route_cache, hash_address(dest_address), (void *) routeData);
-					semaphore_V(route_cache_semaphore);
-
-					for (j = 0; j < routeRequest->threads_waiting; j++)
-						semaphore_V(routeRequest->waiting_semaphore);
+					hashmap_delete(current_discovery_requests, hash_address(dest_address));
+					condition_broadcast(routeRequest->route_found);
+					mutex_unlock(route_cache_mutex);
 
 					delete_route_request(routeRequest);
-					hashmap_delete(current_discovery_requests, hash_address(dest_address));
 
 					success = 1;
 					break;
@@ -299,11 +288,12 @@ int miniroute_send_pkt(network_address_t dest_address, int hdr_len, char* hdr, i
 
 			if (success == 0)
 			{
-				for (j = 0; j < routeRequest->threads_waiting; j++)
-					semaphore_V(routeRequest->waiting_semaphore);
+				mutex_lock(route_cache_mutex);
+				hashmap_delete(current_discovery_requests, hash_address(dest_address));
+				condition_broadcast(routeRequest->route_found);
+				mutex_unlock(route_cache_mutex);
 
 				delete_route_request(routeRequest);
-				hashmap_delete(current_discovery_requests, hash_address(dest_address));
 				if (routingHeader != NULL)
 					free(routingHeader);
 				if (fullHeader != NULL)
@@ -347,24 +337,14 @@ route_request_t new_route_request()
 	if (routeRequest == NULL)
 		return NULL;
 
-	routeRequest->threads_waiting = 0;
 	routeRequest->initiator_semaphore = semaphore_create();
 	semaphore_initialize(routeRequest->initiator_semaphore, 0);
-	routeRequest->waiting_semaphore = semaphore_create();
-	semaphore_initialize(routeRequest->waiting_semaphore, 0);
+	routeRequest->route_found = condition_create();
 	routeRequest->interrupt_arg = NULL;
 
 	return routeRequest;
 }
 
-//Wakes up the sending thread after route discovery timeout
-void alarm_wakeup_semaphore(void* arg)
-{
-//	semaphore_t semaphore = (semaphore_t) arg;
-//TODO uncomment these before submitting	if (semaphore != NULL)
-//		semaphore_V(semaphore);
-}
-
 network_address_t* miniroute_cache(char *newroute, int l1, network_address_t sender)
 {
 	int i;
@@ -383,9 +363,9 @@ network_address_t* miniroute_cache(char *newroute, int l1, network_address_t sen
 	new_cache_entry->route = ret;
 	new_cache_entry->length = l1;
 	new_cache_entry->time_found = currentTime; 
-	semaphore_P(route_cache_semaphore);	
+	mutex_lock(route_cache_mutex);	
 	hashmap_insert(route_cache, hash_address(sender), (void *) new_cache_entry);
-	semaphore_V(route_cache_semaphore);
+	mutex_unlock(route_cache_mutex);
 	return ret;
 }
 
@@ -465,7 +445,7 @@ void delete_route_request(route_request_t route_request)
 		free(route_request->interrupt_arg);
 
 	semaphore_destroy(route_request->initiator_semaphore);
-	semaphore_destroy(route_request->waiting_semaphore);
+	condition_destroy(route_request->route_found);
 	free(route_request);
 }
 
@@ -45,9 +45,8 @@ struct routing_header
 
 struct route_request
 {
-	int threads_waiting;
 	semaphore_t initiator_semaphore;
-	semaphore_t waiting_semaphore;
+	condition_t route_found; /* signalled, under route_cache_mutex, once the discovery ends */
 	network_interrupt_arg_t *interrupt_arg;
 };
 
@@ -17,8 +17,8 @@
 
 minisocket_t* minisockets;
 
-semaphore_t server_mutex;
-semaphore_t client_mutex;
+mutex_t server_mutex;
+mutex_t client_mutex;
 
 queue_t sockets_to_delete;
 
@@ -47,12 +47,10 @@ void minisocket_initialize()
 	}
 
 	//Mutex that controls access to the minithreads array for server ports
-	server_mutex = semaphore_create();
-	semaphore_initialize(server_mutex, 1);
+	server_mutex = mutex_create();
 
 	//Mutex that controls access to the minithreads array for client ports
-	client_mutex = semaphore_create();
-	semaphore_initialize(client_mutex, 1);
+	client_mutex = mutex_create();
 
 	//Queue of sockets that will be deleted
 	sockets_to_delete = queue_new();
@@ -104,21 +102,6 @@ mini_header_reliable_t create_reliable_header(network_address_t src_addr_raw,
 	return header;
 }
 
-/* Used to wakeup a thread when it's attempting retransmissions */
-void wake_up_semaphore(void* arg)
-{
-	minisocket_t socket = (minisocket_t) arg;
-	interrupt_level_t prev_level = set_interrupt_level(DISABLED);
-
-	if (socket != NULL && (socket->waiting == TCP_PORT_WAITING_ACK 
-				|| socket->waiting == TCP_PORT_WAITING_SYNACK))
-	{
-		semaphore_V(socket->wait_for_ack_semaphore);
-	}
-
-	set_interrupt_level(prev_level);
-}
-
 //Transmit a packet and handle retransmission attempts
 int transmit_packet(minisocket_t socket, network_address_t dst_addr, int dst_port, 
 		short incr_seq, char message_type, int data_len, char* data,
@@ -126,7 +109,6 @@ int transmit_packet(minisocket_t socket, network_address_t dst_addr, int dst_por
 {
 	mini_header_reliable_t newReliableHeader;
 
-	void *alarmId;
 	int sendSucessful;
 	network_address_t my_addr;
 	int success = 0;
@@ -166,16 +148,16 @@ int transmit_packet(minisocket_t socket, network_address_t dst_addr, int dst_por
 
 
 
-		alarmId = register_alarm(socket->timeout, &wake_up_semaphore, socket);
+		//An ack arriving in time leaves waiting at TCP_PORT_WAITING_NONE
 		if (message_type == MSG_SYN)
 		{
 			socket->waiting = TCP_PORT_WAITING_SYNACK;
-			semaphore_P(socket->wait_for_ack_semaphore);
+			semaphore_P_timeout(socket->wait_for_ack_semaphore, socket->timeout);
 		}
 		else if (!connected)
 		{
 			socket->waiting = TCP_PORT_WAITING_ACK;
-			semaphore_P(socket->wait_for_ack_semaphore);
+			semaphore_P_timeout(socket->wait_for_ack_semaphore, socket->timeout);
 		}
 		else {
 			socket->waiting = TCP_PORT_WAITING_NONE;
@@ -203,7 +185,6 @@ int transmit_packet(minisocket_t socket, network_address_t dst_addr, int dst_por
 				continue;
 			}
 
-			deregister_alarm(alarmId);
 			success = 1;
 			semaphore_V(socket->mutex);
 			break;
@@ -212,7 +193,6 @@ int transmit_packet(minisocket_t socket, network_address_t dst_addr, int dst_por
 		{
 			if (socket->status == TCP_PORT_UNABLE_TO_CONNECT)
 			{
-				deregister_alarm(alarmId);
 				success = 0;
 				semaphore_V(socket->mutex);
 				break;
@@ -391,6 +371,7 @@ minisocket_t minisocket_server_create(int port, minisocket_error *error)
 	int connected = 1;
 	network_interrupt_arg_t *arg;
 	mini_header_reliable_t header;
+	interrupt_level_t previousLevel;
 
 	if (error == NULL)
 		return NULL;
@@ -401,13 +382,13 @@ minisocket_t minisocket_server_create(int port, minisocket_error *error)
 		return NULL;
 	}
 
-	semaphore_P(server_mutex);
+	mutex_lock(server_mutex);
 
 	//Checks if port already exists
 	if (minisockets[port] != NULL)
 	{
 		*error = SOCKET_PORTINUSE;
-		semaphore_V(server_mutex);
+		mutex_unlock(server_mutex);
 		return NULL;
 	}
 
@@ -415,20 +396,22 @@ minisocket_t minisocket_server_create(int port, minisocket_error *error)
 	if (newMinisocket == NULL)
 	{
 		*error = SOCKET_OUTOFMEMORY;
-		semaphore_V(server_mutex);
+		mutex_unlock(server_mutex);
 		return NULL;
 	}
 
 	newMinisocket->port_type = TCP_PORT_TYPE_SERVER;
 	minisockets[port] = newMinisocket;
 
-	semaphore_V(server_mutex);
+	mutex_unlock(server_mutex);
 
 	while (connected == 1)
 	{
 		semaphore_P(newMinisocket->packet_ready);
 		
+		previousLevel = set_interrupt_level(DISABLED);
 		queue_dequeue(newMinisocket->waiting_packets, (void **) &arg);
+		set_interrupt_level(previousLevel);
 		header = (mini_header_reliable_t) arg->buffer;
 		if (header->message_type != MSG_SYN)
 			continue;
@@ -490,7 +473,7 @@ minisocket_t minisocket_client_create(network_address_t addr, int port, minisock
 	if (error == NULL)
 		return NULL;
 
-	semaphore_P(client_mutex);
+	mutex_lock(client_mutex);
 
 	while (i < totalClientPorts && (minisockets[convertedPortNumber] != NULL))
 	{
@@ -502,7 +485,7 @@ minisocket_t minisocket_client_create(network_address_t addr, int port, minisock
 	if (minisockets[convertedPortNumber] != NULL)
 	{
 		*error = SOCKET_NOMOREPORTS;
-		semaphore_V(client_mutex);
+		mutex_unlock(client_mutex);
 		return NULL;		
 	}
 
@@ -510,7 +493,7 @@ minisocket_t minisocket_client_create(network_address_t addr, int port, minisock
 	if (newMinisocket == NULL)
 	{
 		*error = SOCKET_OUTOFMEMORY;
-		semaphore_V(client_mutex);
+		mutex_unlock(client_mutex);
 		return NULL;
 	}
 
@@ -521,7 +504,7 @@ minisocket_t minisocket_client_create(network_address_t addr, int port, minisock
 	minisockets[convertedPortNumber] = newMinisocket;
 	newMinisocket->status = TCP_PORT_CONNECTING;
 
-	semaphore_V(client_mutex);
+	mutex_unlock(client_mutex);
 
 	transmitCheck = transmit_packet(newMinisocket, addr, port, 1, MSG_SYN, 0, NULL, error);
 	if (transmitCheck == -1)
@@ -10,7 +10,14 @@
 #include "minifile.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include "interrupts.h"
+#include "interrupts_private.h"
 #include "network.h"
 #include "minimsg.h"
 #include "miniroute.h"
@@ -23,6 +30,7 @@
 #include <assert.h>
 #include "alarm.h"
 #include "read.h"
+#include "trace.h"
 #define USER_DEBUG 1
 
 /*
@@ -33,144 +41,343 @@
  * that you feel they must have.
  */
 
-sortedlist_t alarms;
+timerwheel_t alarms;
 
 int QUANTA = 10 * MILLISECOND;
 int currentTime;
-int quantaRemaining;
 int quantaAssignments[4] = {1, 2, 4, 8};
 
-//Keeps track of the RUNNING Thread
-minithread_t runningThread;
+/*
+ * Every AGING_PERIOD quanta the threads waiting at the lowest level move up
+ * one, so a thread demoted there is not starved by a stream of higher
+ * priority work.
+ */
+#define AGING_PERIOD 100
+int minithread_workers = 1;
+int minithread_tickless = 0;
+int minithread_polled_io = 0;
+
+//In polled mode, the eventfd devices write to when they queue an interrupt
+static int deviceEvents = -1;
+
+/*
+ * A worker is one host thread running minithreads. Each has its own ready
+ * queue, idle thread and quantum; everything else is shared, and protected
+ * by disabling interrupts, which also takes the kernel lock (interrupts.h).
+ */
+struct worker {
+	int id;
+	//Queue of the READY Threads that belong to this worker
+	multilevel_queue_t readyQueue;
+	//Runs only when readyQueue is empty, never enqueued itself
+	minithread_t idleThread;
+	//Time idleThread has spent parked in the host kernel, in milliseconds
+	uint64_t idleMillis;
+	//Set while idleThread is parked, cleared by whoever wakes it
+	int parked;
+	//Eventfd written to wake idleThread when another worker makes a thread
+	//runnable here
+	int wakeup;
+	//Epoll instance idleThread parks on, watching wakeup and in polled mode
+	//deviceEvents
+	int poller;
+	//The worker's host thread clock
+	timer_t clock;
+	//In tickless mode, the host thread CPU time up to which quanta have
+	//been counted, and whether the clock is stopped
+	long clockBase;
+	int clockStopped;
+};
+
+static struct worker *workers;
+
+//The worker run by the calling host thread
+static __thread struct worker *currentWorker;
+
+//Quanta left before the RUNNING Thread of this worker is preempted
+static __thread int quantaRemaining;
+
+//Keeps track of the RUNNING Thread of this worker
+__thread minithread_t runningThread;
 
 //Used to set Thread ID
 int threadId = 0;
 
 //Used to set id of outgoing ROUTING_DISCOVERY/REPLY packets
 
-//Queue of all READY Threads
-static multilevel_queue_t multiqueue;
+//Exited Threads that could not be pooled, freed by the next thread
+//to be created or to exit
+static struct intrusive_queue finishedThreads;
 
-//Queue of all FINISHED Threads
-static queue_t queue_finished_threads;
+//Every live thread, idle threads included, linked through allLink in the
+//order they were created
+static struct intrusive_queue allThreads;
 
-//Cleanup Semaphore
-static semaphore_t cleanupSemaphore;
+//minithread_cycles() and alarm_now() at startup, to convert cycles to time
+static long cyclesBase;
+static long nanosBase;
 
+//Packets the network interrupt has taken in and network_bottom_half has yet
+//to process, and posted when the first of a batch comes in
+static queue_t pendingPackets;
+static semaphore_t packetsPending;
 
 /*
-//HELPER FUNCTIONS
-int minithread_cleanup(arg_t arg)
-{
-	minithread_t newMinithread;
-	interrupt_level_t previousLevel;
+ * Exited Threads are kept, stack and all, in a pool per stack size and
+ * recycled by minithread_create, so forking a thread usually allocates
+ * nothing. Each pool holds at most STACK_POOL_LIMIT threads.
+ */
+#define STACK_POOLS 4
+#define STACK_POOL_LIMIT 256
 
-	while (1)
-	{
-		//Editing the cleanup queue, so disable interrupts
-		previousLevel = set_interrupt_level(DISABLED);
+struct stack_pool {
+	int stackSize; //0 if the pool is unused
+	struct intrusive_queue threads;
+};
 
-		//Wait to be woken up
-		semaphore_P(cleanupSemaphore);
+static struct stack_pool stackPools[STACK_POOLS];
 
-		//Only cleanup when there are threads to cleanup
-		while (queue_length(queue_finished_threads) > 0)
-		{
-			//Get the next newMinithread for the thread to free up
-			queue_dequeue(queue_finished_threads, (void**) &newMinithread);
 
-			//Free the stack
-			minithread_free_stack(*(newMinithread->stack_base));
+//HELPER FUNCTIONS
+/*
+ * Return the pool for stacks of stackSize bytes, claiming an unused pool if
+ * there is none yet, or NULL if all pools are taken by other sizes.
+ * Interrupts must be disabled.
+ */
+static struct stack_pool*
+minithread_stack_pool(int stackSize)
+{
+	int i;
 
-			//Free the newMinithread
-			free(newMinithread);
+	for (i = 0; i < STACK_POOLS; i++)
+	{
+		if (stackPools[i].stackSize == stackSize)
+			return &stackPools[i];
+	}
+	for (i = 0; i < STACK_POOLS; i++)
+	{
+		if (stackPools[i].stackSize == 0)
+		{
+			stackPools[i].stackSize = stackSize;
+			intrusive_queue_init(&stackPools[i].threads);
+			return &stackPools[i];
 		}
-
-		//Restore interrupt level
-		set_interrupt_level(previousLevel);
 	}
+	return NULL;
+}
 
-	return 0;
-}*/
-
-int minithread_cleanup(arg_t arg)
+/*
+ * Free the exited threads that did not fit in a pool. The running thread
+ * may be among them if it is on its way out, so it is left for later.
+ * Interrupts must be disabled.
+ */
+static void
+minithread_reap()
 {
-	queue_t oldThreads = (queue_t) arg;
+	queue_link_t link;
 	minithread_t oldThread;
-	while (queue_length(oldThreads) > 0)
+	int remaining = intrusive_queue_length(&finishedThreads);
+
+	while (remaining-- > 0)
 	{
-		queue_dequeue(oldThreads, (void **) &oldThread);
-		minithread_free_stack(*(oldThread->stack_base));
+		link = intrusive_queue_dequeue(&finishedThreads);
+		oldThread = queue_entry(link, struct minithread, link);
+		if (oldThread == runningThread)
+		{
+			intrusive_queue_append(&finishedThreads, link);
+			continue;
+		}
+		minithread_free_stack_size(oldThread->stack_base, oldThread->stack_size,
+			oldThread->stack_guarded);
 		free(oldThread);
 	}
-	queue_free(oldThreads);
-	return 0;
 }
 
+/*
+ * Charge thread for the time it has spent in its current status, and move
+ * it to status at now, a minithread_cycles() time. Interrupts must be
+ * disabled.
+ */
+static void
+minithread_set_status(minithread_t thread, int status, long now)
+{
+	if (thread->status == MINITHREAD_RUNNING)
+		thread->runCycles += now - thread->statusSince;
+	else if (thread->status == MINITHREAD_READY)
+		thread->readyCycles += now - thread->statusSince;
+	else
+		thread->blockedCycles += now - thread->statusSince;
+	thread->status = status;
+	thread->statusSince = now;
+}
+
+/*
+ * Return the CPU time of the calling host thread in nanoseconds.
+ */
+static long
+minithread_cpu_time()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec * (long) SECOND + now.tv_nsec;
+}
+
+/*
+ * Return the whole quanta this worker has run since they were last counted,
+ * and count them. Tickless mode only. Interrupts must be disabled.
+ */
+static int
+minithread_clock_elapsed()
+{
+	int ticks = (minithread_cpu_time() - currentWorker->clockBase) / QUANTA;
+
+	currentWorker->clockBase += (long) ticks * QUANTA;
+	return ticks;
+}
+
+/*
+ * Make worker's clock go off after at most ticks quanta, bringing it
+ * forward if it was programmed for later or stopped. Any worker may call
+ * this. Tickless mode only. Interrupts must be disabled.
+ */
+static void
+minithread_clock_bring_forward(struct worker *worker, int ticks)
+{
+	if (!worker->clockStopped &&
+		minithread_clock_remaining(worker->clock) <= (long) ticks * QUANTA)
+		return;
+	worker->clockStopped = 0;
+	minithread_clock_set(worker->clock, (long) ticks * QUANTA, QUANTA);
+}
 
 void
 minithread_exit(minithread_t thread)
 {
 	minithread_t to_run;
 	minithread_t old_thread;
-	queue_t oldThreads;
-	int start = get_priority_of_thread();
-	queue_append(queue_finished_threads, thread);
-	if (queue_length(queue_finished_threads) > 10)
-	{
-		oldThreads = queue_finished_threads;
-		queue_finished_threads = queue_new();
-		minithread_fork(minithread_cleanup, (int *) oldThreads);
-	}
-	multilevel_queue_dequeue(multiqueue, start, (void **) &to_run);
+	struct stack_pool *pool;
+	int start;
+
+	//Nothing may run on this stack once the thread is in a pool
+	set_interrupt_level(DISABLED);
+	start = get_priority_of_thread();
+
+	minithread_reap();
+	pool = minithread_stack_pool(thread->stack_size);
+	if (pool != NULL && intrusive_queue_length(&pool->threads) < STACK_POOL_LIMIT)
+		intrusive_queue_append(&pool->threads, &thread->link);
+	else
+		intrusive_queue_append(&finishedThreads, &thread->link);
+	intrusive_queue_delete(&allThreads, &thread->allLink);
+
+	if (deviceEvents >= 0)
+		interrupt_poll();
+	multilevel_queue_dequeue(currentWorker->readyQueue, start, (void **) &to_run);
 	if (to_run == NULL)
-	{
-		while (multilevel_queue_fulllength(multiqueue) == 0);
-		multilevel_queue_dequeue(multiqueue, 0, (void **) &to_run);
-	}
+		to_run = currentWorker->idleThread;
 	old_thread = runningThread;
 	runningThread = to_run;
+	minithread_set_status(to_run, MINITHREAD_RUNNING, minithread_cycles());
+	TRACE(TRACE_SWITCH, old_thread->id, to_run->id);
 
-	minithread_switch(old_thread->stack_top, to_run->stack_top);
+	minithread_switch(&old_thread->stack_top, &to_run->stack_top);
 }
 
 //REQUIRED FUNCTIONS
 minithread_t
 minithread_fork(proc_t proc, arg_t arg) {
+	return minithread_fork_with_stack(proc, arg, STACKSIZE);
+}
+
+minithread_t
+minithread_fork_with_stack(proc_t proc, arg_t arg, int stack_size) {
 	//Make newMinithread
-	minithread_t newMinithread = (minithread_t) minithread_create(proc, arg);
+	minithread_t newMinithread = minithread_create_with_stack(proc, arg, stack_size);
 	//Start newMinithread
-	multilevel_queue_enqueue(multiqueue, 0, newMinithread);
+	if (newMinithread != NULL)
+		minithread_start(newMinithread);
 	//Return newMinithread
-	return (minithread_t) newMinithread;
+	return newMinithread;
 }
 
 minithread_t
 minithread_create(proc_t proc, arg_t arg) {
-	minithread_t newMinithread = (minithread_t) malloc(sizeof(struct minithread));
-	stack_pointer_t* stack_top = (stack_pointer_t*) malloc(sizeof(stack_pointer_t));
-	stack_pointer_t* stack_base = (stack_pointer_t*) malloc(sizeof(stack_pointer_t));
-
-	*stack_base = NULL;
+	return minithread_create_with_stack(proc, arg, STACKSIZE);
+}
 
-	minithread_allocate_stack(stack_base, stack_top);
+minithread_t
+minithread_create_with_stack(proc_t proc, arg_t arg, int stack_size) {
+	minithread_t newMinithread = NULL;
+	struct stack_pool *pool;
+	queue_link_t link = NULL;
+	interrupt_level_t previousLevel;
+	int id;
+	int worker;
 
-	if (*stack_base == NULL)
+	if (stack_size <= 0)
 		return NULL;
 
+	previousLevel = set_interrupt_level(DISABLED);
+	id = threadId++;
+	//New threads start out on the worker that made them; idle workers
+	//steal them from there
+	worker = currentWorker->id;
+
+	//Recycle an exited thread with a stack of the right size if there is one
+	minithread_reap();
+	pool = minithread_stack_pool(stack_size);
+	if (pool != NULL)
+		link = intrusive_queue_dequeue(&pool->threads);
+	set_interrupt_level(previousLevel);
+
+	if (link != NULL)
+	{
+		newMinithread = queue_entry(link, struct minithread, link);
+	}
+	else
+	{
+		newMinithread = (minithread_t) malloc(sizeof(struct minithread));
+		if (newMinithread == NULL)
+			return NULL;
+
+		newMinithread->stack_guarded = minithread_allocate_stack_size(
+			&newMinithread->stack_base, &newMinithread->stack_origin, stack_size);
+		if (newMinithread->stack_base == NULL)
+		{
+			free(newMinithread);
+			return NULL;
+		}
+		newMinithread->stack_size = stack_size;
+	}
+
 	newMinithread->proc = proc;
 	newMinithread->arg = arg;
 	newMinithread->level = 0;
-	//newMinithread->status = WAITING;
-	newMinithread->id = threadId++;
-	newMinithread->stack_base = stack_base;
-	newMinithread->stack_top = stack_top;
+	newMinithread->cpuTicks = 0;
+	newMinithread->levelTicks = 0;
+	newMinithread->pinned = 0;
+	newMinithread->voluntarySwitches = 0;
+	newMinithread->involuntarySwitches = 0;
+	//Blocked until started
+	newMinithread->status = MINITHREAD_BLOCKED;
+	newMinithread->statusSince = minithread_cycles();
+	newMinithread->runCycles = 0;
+	newMinithread->readyCycles = 0;
+	newMinithread->blockedCycles = 0;
+	newMinithread->id = id;
+	newMinithread->worker = worker;
+	newMinithread->stack_top = newMinithread->stack_origin;
 	newMinithread->currentDirectoryInode = 0;
 
-	minithread_initialize_stack(stack_top, proc, arg, (proc_t) minithread_exit, (arg_t) newMinithread);
+	minithread_initialize_stack(&newMinithread->stack_top, proc, arg, (proc_t) minithread_exit, (arg_t) newMinithread);
+
+	previousLevel = set_interrupt_level(DISABLED);
+	intrusive_queue_append(&allThreads, &newMinithread->allLink);
+	set_interrupt_level(previousLevel);
 
 	//Return minithread
-    return (minithread_t) newMinithread;
+	return newMinithread;
 }
 
 minithread_t
@@ -188,34 +395,63 @@ minithread_stop() {
 	//Get next thread to be run
 	minithread_t oldThread = runningThread;
 	minithread_t to_run;
-	int start = get_priority_of_thread();
+	long now;
+	int start;
 	set_interrupt_level(DISABLED);
-	
+	start = get_priority_of_thread();
+	if (deviceEvents >= 0)
+		interrupt_poll();
 
-	multilevel_queue_dequeue(multiqueue, start, (void **) &to_run);
+	multilevel_queue_dequeue(currentWorker->readyQueue, start, (void **) &to_run);
 
+	//Nothing else to run, park in the idle thread until an interrupt
+	//makes a thread runnable
 	if (to_run == NULL)
-	{
-		set_interrupt_level(ENABLED);
-		while (multilevel_queue_fulllength(multiqueue) == 0);
-		set_interrupt_level(DISABLED);
-		multilevel_queue_dequeue(multiqueue, start, (void **) &to_run);
-	}
+		to_run = currentWorker->idleThread;
 	//Switch to the next thread to be "run"
-	//Set Status' of Threads
-	//oldThread->status = RUNABLE;
+	now = minithread_cycles();
+	oldThread->voluntarySwitches++;
+	minithread_set_status(oldThread, MINITHREAD_BLOCKED, now);
 	runningThread = to_run;
-
-	//runningThread->status = RUNNING;
+	minithread_set_status(to_run, MINITHREAD_RUNNING, now);
+	TRACE(TRACE_SWITCH, oldThread->id, to_run->id);
 
 	//Set running thread as currently running thread
-	minithread_switch(oldThread->stack_top, runningThread->stack_top);
+	minithread_switch(&oldThread->stack_top, &runningThread->stack_top);
 }
 
 void
 minithread_start(minithread_t t) {
+	struct worker *worker = &workers[t->worker];
 	interrupt_level_t old_level = set_interrupt_level(DISABLED);
-	multilevel_queue_enqueue(multiqueue, 0, t);
+	uint64_t one = 1;
+	int i;
+
+	//A thread waking up before it used up its level's quantum was waiting
+	//on I/O or another thread rather than computing, so it moves up a level
+	if (t->level > 0 && t->levelTicks < quantaAssignments[t->level])
+	{
+		t->level--;
+		t->levelTicks = 0;
+	}
+	//A tickless clock is not programmed to preempt a thread running alone,
+	//so check back after a quantum now that it has company
+	if (minithread_tickless && multilevel_queue_fulllength(worker->readyQueue) == 0 && !worker->parked)
+		minithread_clock_bring_forward(worker, 1);
+	minithread_set_status(t, MINITHREAD_READY, minithread_cycles());
+	multilevel_queue_enqueue(worker->readyQueue, t->level, t);
+	//Wake the worker if it is parked with nothing to run, otherwise any
+	//parked worker, which can steal the thread
+	for (i = 0; i < minithread_workers; i++)
+	{
+		worker = &workers[(t->worker + i) % minithread_workers];
+		if (worker->parked)
+		{
+			worker->parked = 0;
+			write(worker->wakeup, &one, sizeof(one));
+			break;
+		}
+	}
 	set_interrupt_level(old_level);
 }
 
@@ -224,27 +460,290 @@ minithread_yield() {
 	//Variable Initization
 	minithread_t to_run;
 	minithread_t old_thread;
-	int start = get_priority_of_thread();
-	set_interrupt_level(DISABLED);
+	interrupt_level_t previousLevel;
+	long now;
+	int start;
+	previousLevel = set_interrupt_level(DISABLED);
+	start = get_priority_of_thread();
+	if (deviceEvents >= 0)
+		interrupt_poll();
 	//Retrieve to_run
-	multilevel_queue_dequeue(multiqueue, start, (void **) &to_run);
+	multilevel_queue_dequeue(currentWorker->readyQueue, start, (void **) &to_run);
 	
-	//Ensure to_run was retreived properly
+	//Nothing else to run, keep going
 	if (to_run == NULL)
 	{
+		set_interrupt_level(previousLevel);
 		return;
 	}
 	
 	old_thread = runningThread;
 	runningThread = to_run;
+	now = minithread_cycles();
+	old_thread->voluntarySwitches++;
+	minithread_set_status(old_thread, MINITHREAD_READY, now);
+	minithread_set_status(to_run, MINITHREAD_RUNNING, now);
 
-	multilevel_queue_enqueue(multiqueue, old_thread->level, (void *) old_thread);
+	multilevel_queue_enqueue(currentWorker->readyQueue, old_thread->level, (void *) old_thread);
+	TRACE(TRACE_SWITCH, old_thread->id, to_run->id);
 	
-	minithread_switch(old_thread->stack_top, to_run->stack_top);
+	minithread_switch(&old_thread->stack_top, &to_run->stack_top);
+}
+
+/*
+ * Move every READY Thread waiting at the lowest level up one level. Run by
+ * worker 0 every AGING_PERIOD quanta. Interrupts must be disabled.
+ */
+static void
+minithread_age()
+{
+	minithread_t aged;
+	int i;
+
+	for (i = 0; i < minithread_workers; i++)
+	{
+		while (multilevel_queue_take(workers[i].readyQueue, 3, (void **) &aged) != -1)
+		{
+			aged->level = 2;
+			aged->levelTicks = 0;
+			multilevel_queue_enqueue(workers[i].readyQueue, 2, aged);
+		}
+	}
 }
 
-int placeholder(int *arg) {
-	return 0;	
+/*
+ * Advance currentTime by ticks quanta, aging the ready queues on the way.
+ * Only worker 0 keeps time. Interrupts must be disabled.
+ */
+static void
+minithread_tick(int ticks)
+{
+	while (ticks-- > 0)
+	{
+		currentTime++;
+		if (currentTime % AGING_PERIOD == 0)
+			minithread_age();
+	}
+}
+
+/*
+ * Program this worker's clock for the next thing it has to do: preempt the
+ * running thread when its quantum is up if another thread is waiting, and
+ * on worker 0, age the ready queues, at least every AGING_PERIOD quanta,
+ * which also keeps currentTime from falling far behind. Other workers with
+ * nothing to preempt stop their clocks. Alarms have their own clock. If an
+ * interrupt is dropped the clock retries every quantum. Tickless mode only.
+ * Interrupts must be disabled.
+ */
+static void
+minithread_clock_program()
+{
+	long delay;
+	int ticks = 0;
+	int due;
+
+	if (multilevel_queue_fulllength(currentWorker->readyQueue) > 0)
+		ticks = quantaRemaining > 0 ? quantaRemaining : 1;
+	if (currentWorker->id == 0)
+	{
+		due = AGING_PERIOD - currentTime % AGING_PERIOD;
+		if (ticks == 0 || due < ticks)
+			ticks = due;
+	}
+
+	currentWorker->clockStopped = (ticks == 0);
+	if (ticks == 0)
+	{
+		minithread_clock_set(currentWorker->clock, 0, 0);
+		return;
+	}
+	//Go off on a quantum boundary, so the quanta counted come out whole
+	delay = (long) ticks * QUANTA - (minithread_cpu_time() - currentWorker->clockBase);
+	minithread_clock_set(currentWorker->clock, delay > 0 ? delay : 1, QUANTA);
+}
+
+/*
+ * Take a READY Thread from another worker for this one to run, trying the
+ * workers after this one in turn. The thread comes off the back of the
+ * victim's highest priority level and keeps its level. Returns NULL if no
+ * other worker has a thread waiting. Interrupts must be disabled.
+ */
+static minithread_t
+minithread_steal()
+{
+	minithread_t stolen = NULL;
+	int i;
+
+	for (i = 1; i < minithread_workers && stolen == NULL; i++)
+	{
+		multilevel_queue_steal(workers[(currentWorker->id + i) % minithread_workers].readyQueue,
+			(void **) &stolen);
+	}
+	if (stolen != NULL)
+		stolen->worker = currentWorker->id;
+	return stolen;
+}
+
+/*
+ * Body of each worker's idle thread. When the worker's own ready queue is
+ * empty it steals from the other workers, and failing that, instead of
+ * spinning, parks the host thread in epoll_wait on the worker's wakeup
+ * eventfd for at most one quantum at a time. While it is parked
+ * handle_interrupt accepts the next interrupt even though the host thread is
+ * in libc, which also cuts the wait short, and so does another worker making
+ * a thread runnable. In polled mode devices do not interrupt, but the wait
+ * watches their eventfd too, and the idle thread runs their handlers itself.
+ *
+ * The clock is a CPU-time timer and does not tick while the process sleeps,
+ * so worker 0's idle thread advances currentTime itself. Alarms keep real
+ * time on their own clock, which also wakes a parked worker 0.
+ */
+int
+minithread_idle(arg_t arg)
+{
+	struct epoll_event ready[2];
+	minithread_t to_run;
+	uint64_t parkedAt;
+	uint64_t count;
+	int deviceReady;
+	int n = 0;
+	int i;
+	uint64_t slept;
+	uint64_t carry = 0;
+	int ticks;
+
+	while (1)
+	{
+		set_interrupt_level(DISABLED);
+		//Pick up events whose signal was refused while threads ran
+		interrupt_drain();
+		multilevel_queue_dequeue(currentWorker->readyQueue, get_priority_of_thread(), (void **) &to_run);
+		if (to_run == NULL)
+			to_run = minithread_steal();
+		if (to_run != NULL)
+		{
+			runningThread = to_run;
+			minithread_set_status(to_run, MINITHREAD_RUNNING, minithread_cycles());
+			quantaRemaining = quantaAssignments[to_run->level];
+			if (minithread_tickless)
+			{
+				//Count the quanta the idle thread ran before programming
+				//the clock for to_run
+				ticks = minithread_clock_elapsed();
+				if (currentWorker->id == 0)
+					minithread_tick(ticks);
+				minithread_clock_program();
+			}
+			TRACE(TRACE_SWITCH, currentWorker->idleThread->id, to_run->id);
+			minithread_switch(&currentWorker->idleThread->stack_top, &to_run->stack_top);
+			continue;
+		}
+
+		parkedAt = currentTimeMillis();
+		currentWorker->parked = 1;
+		interrupts_parked = 1;
+		set_interrupt_level(ENABLED);
+		//An interrupt or another worker making a thread runnable ends the
+		//wait early; a thread preempted on a busy worker waits at most one
+		//quantum to be stolen
+		if (multilevel_queue_fulllength(currentWorker->readyQueue) == 0)
+			n = epoll_wait(currentWorker->poller, ready, 2, QUANTA / MILLISECOND);
+		interrupts_parked = 0;
+		set_interrupt_level(DISABLED);
+		currentWorker->parked = 0;
+
+		//Rearm whatever woke us
+		deviceReady = 0;
+		for (i = 0; i < n; i++)
+		{
+			if (ready[i].data.fd == deviceEvents)
+				deviceReady = 1;
+			read(ready[i].data.fd, &count, sizeof(count));
+		}
+		n = 0;
+		if (deviceReady)
+			interrupt_drain();
+
+		slept = currentTimeMillis() - parkedAt;
+		currentWorker->idleMillis += slept;
+		if (currentWorker->id != 0)
+			continue;
+		carry += slept;
+		minithread_tick(carry / (QUANTA / MILLISECOND));
+		carry %= QUANTA / MILLISECOND;
+	}
+
+	return 0;
+}
+
+uint64_t
+minithread_idle_time() {
+	uint64_t total = 0;
+	int i;
+
+	for (i = 0; i < minithread_workers; i++)
+		total += workers[i].idleMillis;
+	return total;
+}
+
+long
+minithread_cycles() {
+	unsigned int low;
+	unsigned int high;
+
+	__asm__ volatile ("rdtsc" : "=a" (low), "=d" (high));
+	return ((long) high << 32) | low;
+}
+
+long
+minithread_cycles_to_nanos(long cycles) {
+	long elapsedCycles = minithread_cycles() - cyclesBase;
+	long elapsedNanos = alarm_now() - nanosBase;
+
+	if (elapsedCycles <= 0)
+		return 0;
+	return (long) ((double) cycles * elapsedNanos / elapsedCycles);
+}
+
+int
+minithread_stats(minithread_stat_t *stats, int max) {
+	interrupt_level_t previousLevel;
+	queue_link_t link;
+	minithread_t t;
+	long now;
+	long current;
+	int count = 0;
+
+	previousLevel = set_interrupt_level(DISABLED);
+	now = minithread_cycles();
+	for (link = allThreads.front; link != NULL; link = link->next)
+	{
+		t = queue_entry(link, struct minithread, allLink);
+		if (t == workers[t->worker].idleThread)
+			continue;
+		if (count < max)
+		{
+			stats[count].id = t->id;
+			stats[count].worker = t->worker;
+			stats[count].level = t->level;
+			stats[count].status = t->status;
+			stats[count].cpuTicks = t->cpuTicks;
+			stats[count].voluntarySwitches = t->voluntarySwitches;
+			stats[count].involuntarySwitches = t->involuntarySwitches;
+			//Count the time in the current status up to now
+			current = now - t->statusSince;
+			stats[count].runNanos = minithread_cycles_to_nanos(t->runCycles +
+				(t->status == MINITHREAD_RUNNING ? current : 0));
+			stats[count].readyNanos = minithread_cycles_to_nanos(t->readyCycles +
+				(t->status == MINITHREAD_READY ? current : 0));
+			stats[count].blockedNanos = minithread_cycles_to_nanos(t->blockedCycles +
+				(t->status == MINITHREAD_BLOCKED ? current : 0));
+		}
+		count++;
+	}
+	set_interrupt_level(previousLevel);
+
+	return count;
 }
 
 /*
@@ -255,40 +754,71 @@ int placeholder(int *arg) {
 void 
 clock_handler(void* arg)
 {
-	minithread_t to_run;
+	minithread_t to_run = NULL;
 	minithread_t old_thread;
-	int start = get_priority_of_thread();
+	long now;
+	int start;
+	int ticks = 1;
 	set_interrupt_level(DISABLED);
-	currentTime++;
-	quantaRemaining--;
-	callAlarms(alarms, currentTime);
+	start = get_priority_of_thread();
+	//Events whose signal was refused are handled at the next tick at the latest
+	interrupt_drain();
+	//A tickless clock goes off once for all the quanta run since the last
+	if (minithread_tickless)
+		ticks = minithread_clock_elapsed();
+	TRACE(TRACE_TICK, runningThread->id, ticks);
+	//Every worker has a clock, but only worker 0 keeps time
+	if (currentWorker->id == 0)
+		minithread_tick(ticks);
+	quantaRemaining -= ticks;
+	if (runningThread != currentWorker->idleThread)
+	{
+		runningThread->cpuTicks += ticks;
+		runningThread->levelTicks += ticks;
+	}
 
 	if (quantaRemaining <= 0)
+		multilevel_queue_dequeue(currentWorker->readyQueue, start, (void **) &to_run);
+	if (to_run == NULL)
 	{
-		multilevel_queue_dequeue(multiqueue, start, (void **) &to_run);
-		if (to_run == NULL)
-		{
-			return;
-		}
+		if (minithread_tickless)
+			minithread_clock_program();
+		set_interrupt_level(ENABLED);
+		return;
+	}
 
-		old_thread = runningThread;
-		runningThread = to_run;
-		if (old_thread->level < 3)
+	old_thread = runningThread;
+	runningThread = to_run;
+	//Only a thread that has used up its level's quantum moves down
+	if (old_thread->levelTicks >= quantaAssignments[old_thread->level])
+	{
+		if (old_thread->level < 3 && !old_thread->pinned)
 			old_thread->level++;
-		quantaRemaining = quantaAssignments[to_run->level];
+		old_thread->levelTicks = 0;
+	}
+	quantaRemaining = quantaAssignments[to_run->level];
 
-		multilevel_queue_enqueue(multiqueue, old_thread->level, (void *) old_thread);
+	now = minithread_cycles();
+	minithread_set_status(old_thread, MINITHREAD_READY, now);
+	minithread_set_status(to_run, MINITHREAD_RUNNING, now);
 
-		minithread_switch(old_thread->stack_top, to_run->stack_top);
+	//The idle thread is picked up again only when the queue is empty
+	if (old_thread != currentWorker->idleThread)
+	{
+		old_thread->involuntarySwitches++;
+		multilevel_queue_enqueue(currentWorker->readyQueue, old_thread->level, (void *) old_thread);
 	}
-	set_interrupt_level(ENABLED);
+
+	if (minithread_tickless)
+		minithread_clock_program();
+	TRACE(TRACE_SWITCH, old_thread->id, to_run->id);
+	minithread_switch(&old_thread->stack_top, &to_run->stack_top);
 }
 
 void
 minithread_sleep_alarm_wakeup(void *arg)
 {
-	semaphore_t sleepSem = (semaphore_t) arg;
-	semaphore_V(sleepSem);
+	minithread_start((minithread_t) arg);
 }
 
 /*
@@ -297,22 +827,20 @@ minithread_sleep_alarm_wakeup(void *arg)
 void 
 minithread_sleep_with_timeout(int delay)
 {
-	semaphore_t sleepSemaphore = semaphore_create();
-
 	interrupt_level_t previousLevel;
 
-	semaphore_initialize(sleepSemaphore, 0);
+	//An alarm due now would start us before we had stopped
+	if (delay <= 0)
+		return;
 
 	//Interrupts are disabled so that if we context switch away the alarm will
-	//not be triggered before semaphore_P is called and will not hang forever
+	//not be triggered before minithread_stop is called and will not hang forever
 	previousLevel = set_interrupt_level(DISABLED);
-	printf("delay: %d\n", delay);
 
-	register_alarm(delay, &minithread_sleep_alarm_wakeup, sleepSemaphore); 
+	//The alarm starts this thread again, no semaphore needed
+	register_alarm(delay, &minithread_sleep_alarm_wakeup, minithread_self()); 
 
-	semaphore_P(sleepSemaphore);
-
-	semaphore_destroy(sleepSemaphore);
+	minithread_stop();
 
 	set_interrupt_level(previousLevel);
 }
@@ -324,6 +852,7 @@ void handle_data_packet(network_interrupt_arg_t *arg) {
 	miniport_t incomingPort;
 	unsigned int ack;
 	unsigned int seq;
+	interrupt_level_t previousLevel;
 	mini_header_t header = (mini_header_t) arg->buffer; 
 	if (header->protocol == PROTOCOL_MINIDATAGRAM)
 	{
@@ -334,7 +863,9 @@ void handle_data_packet(network_interrupt_arg_t *arg) {
 			printf("packet dropped like it's hot\n");
 			return;
 		}
-  		queue_append(incomingPort->port_data.unbound.data_queue, (void *) arg);
+		previousLevel = set_interrupt_level(DISABLED);
+		queue_append(incomingPort->port_data.unbound.data_queue, (void *) arg);
+		set_interrupt_level(previousLevel);
 		semaphore_V(incomingPort->port_data.unbound.data_available);
 	}
 	else 
@@ -381,7 +912,9 @@ void handle_data_packet(network_interrupt_arg_t *arg) {
 			}
 			printf("received data packet, local ack=%d, packet seq=%d\n", incomingSocket->ack_number, seq);
 			incomingSocket->ack_number++;
+			previousLevel = set_interrupt_level(DISABLED);
 			queue_append(incomingSocket->waiting_packets, arg);
+			set_interrupt_level(previousLevel);
 			semaphore_V(incomingSocket->packet_ready);
 		}
 		semaphore_V(incomingSocket->mutex);
@@ -404,7 +937,12 @@ char* reverse_path(char (*path)[8], int len1) {
 	return ret;
 }
 
-void network_handler(network_interrupt_arg_t *arg) {
+/*
+ * Route, forward or deliver one packet. Runs in network_bottom_half with
+ * interrupts enabled.
+ */
+static void
+network_process_packet(network_interrupt_arg_t *arg) {
 	routing_header_t header = (routing_header_t) arg->buffer;	
 	network_address_t my_addr;
 	network_address_t dst;
@@ -570,6 +1108,79 @@ void network_handler(network_interrupt_arg_t *arg) {
 	}
 }
 
+/*
+ * Network interrupt handler. Only queues the packet for network_bottom_half,
+ * so that interrupts stay disabled for as short a time as possible.
+ */
+void network_handler(network_interrupt_arg_t *arg) {
+	queue_append(pendingPackets, arg);
+	if (queue_length(pendingPackets) == 1)
+		semaphore_V(packetsPending);
+}
+
+/*
+ * Body of the network bottom half: processes the packets network_handler
+ * queues, a batch per wakeup, taking each off the queue with interrupts
+ * disabled and handling it with them enabled, where it may block and send.
+ * The thread is pinned at the highest priority level, so packets are
+ * handled ahead of threads computing however long a batch takes.
+ */
+static int
+network_bottom_half(arg_t arg)
+{
+	network_interrupt_arg_t *packet;
+	interrupt_level_t previousLevel;
+	int empty;
+
+	while (1)
+	{
+		semaphore_P(packetsPending);
+		do
+		{
+			previousLevel = set_interrupt_level(DISABLED);
+			empty = queue_dequeue(pendingPackets, (void **) &packet) != 0;
+			set_interrupt_level(previousLevel);
+			if (!empty)
+				network_process_packet(packet);
+		} while (!empty);
+	}
+
+	return 0;
+}
+
+/*
+ * Body of the host thread behind every worker but worker 0. It takes the
+ * kernel lock, starts its own clock and switches into its idle thread,
+ * never to return; the switch releases the lock again.
+ */
+static void*
+minithread_worker(void *arg)
+{
+	struct worker *worker = (struct worker *) arg;
+	//The host context is saved here by the first switch and never resumed
+	stack_pointer_t hostStack;
+	sigset_t set;
+
+	set_interrupt_level(DISABLED);
+	currentWorker = worker;
+	TRACE_THREAD_INIT();
+	runningThread = worker->idleThread;
+	minithread_set_status(runningThread, MINITHREAD_RUNNING, minithread_cycles());
+	quantaRemaining = 0;
+	worker->clock = minithread_clock_init_thread(QUANTA);
+	worker->clockBase = minithread_cpu_time();
+
+	//The thread was created with interrupts blocked so none arrived before
+	//it had a worker to run them on
+	sigemptyset(&set);
+	sigaddset(&set, SIGRTMAX-1);
+	sigaddset(&set, SIGRTMAX-2);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+	minithread_switch(&hostStack, &worker->idleThread->stack_top);
+	return NULL;
+}
+
 /*
  * Initialization.
  *
@@ -586,37 +1197,95 @@ void network_handler(network_interrupt_arg_t *arg) {
  */
 void
 minithread_system_initialize(proc_t mainproc, arg_t mainarg) {
-	minithread_t mainThread = (minithread_t) malloc(sizeof(struct minithread));
-	minithread_t idleThread2;	
-	minithread_t idleThread;
-	
-	alarms = new_sortedlist();
+	minithread_t mainThread;
+	minithread_t bottomHalf;
+	//The host context is saved here by the first switch and never resumed
+	stack_pointer_t hostStack;
+	pthread_t host;
+	sigset_t set;
+	sigset_t oldSet;
+	struct epoll_event watch;
+	int i;
 
-	cleanupSemaphore = semaphore_create();
-	semaphore_initialize(cleanupSemaphore, 0);
+	//This host thread becomes worker 0. It holds the kernel lock until the
+	//switch into mainThread below
+	set_interrupt_level(DISABLED);
+	TRACE_THREAD_INIT();
 	
 	currentTime = 0;
 
 	quantaRemaining = 0;
 
-	multiqueue = multilevel_queue_new(4);
+	if (minithread_workers < 1)
+		minithread_workers = 1;
 
-	queue_finished_threads = queue_new();
-	
-	idleThread = minithread_create(placeholder, (arg_t) NULL);
-	queue_append(queue_finished_threads, idleThread);
+	intrusive_queue_init(&finishedThreads);
+	intrusive_queue_init(&allThreads);
+	cyclesBase = minithread_cycles();
+	nanosBase = alarm_now();
+
+	//Before any device starts queueing interrupts
+	if (minithread_polled_io)
+		deviceEvents = interrupt_poll_init();
+
+	workers = (struct worker *) calloc(minithread_workers, sizeof(struct worker));
+	currentWorker = &workers[0];
+	for (i = 0; i < minithread_workers; i++)
+	{
+		workers[i].id = i;
+		workers[i].readyQueue = multilevel_queue_new(4, offsetof(struct minithread, link));
+		workers[i].idleThread = minithread_create(minithread_idle, (arg_t) NULL);
+		workers[i].idleThread->worker = i;
+		workers[i].idleMillis = 0;
+		workers[i].parked = 0;
+		workers[i].wakeup = eventfd(0, EFD_NONBLOCK);
+		workers[i].poller = epoll_create1(0);
+		AbortOnCondition(workers[i].wakeup == -1 || workers[i].poller == -1, "eventfd");
+		watch.events = EPOLLIN;
+		watch.data.fd = workers[i].wakeup;
+		epoll_ctl(workers[i].poller, EPOLL_CTL_ADD, workers[i].wakeup, &watch);
+		if (deviceEvents >= 0)
+		{
+			//Wake one parked worker per batch rather than all of them
+			watch.events = EPOLLIN | EPOLLEXCLUSIVE;
+			watch.data.fd = deviceEvents;
+			epoll_ctl(workers[i].poller, EPOLL_CTL_ADD, deviceEvents, &watch);
+		}
+	}
 	mainThread = minithread_create(mainproc, mainarg);
 	
 	runningThread = mainThread;
+	minithread_set_status(mainThread, MINITHREAD_RUNNING, minithread_cycles());
 
 
-	minithread_clock_init(QUANTA, clock_handler);
+	workers[0].clock = minithread_clock_init(QUANTA, clock_handler);
+	workers[0].clockBase = minithread_cpu_time();
+	alarm_initialize();
 	miniterm_initialize();
 	miniroute_initialize();
 	minisocket_initialize();
 	minimsg_initialize();
 	miniroute_initialize();
+	pendingPackets = queue_new();
+	packetsPending = semaphore_create();
+	semaphore_initialize(packetsPending, 0);
+	bottomHalf = minithread_create(network_bottom_half, NULL);
+	bottomHalf->pinned = 1;
+	minithread_start(bottomHalf);
 	network_initialize(network_handler);
 	minifile_initialize();
-	minithread_switch(idleThread->stack_top, mainThread->stack_top);	
+
+	//Start the other workers; they wait for the kernel lock
+	sigemptyset(&set);
+	sigaddset(&set, SIGRTMAX-1);
+	sigaddset(&set, SIGRTMAX-2);
+	pthread_sigmask(SIG_BLOCK, &set, &oldSet);
+	for (i = 1; i < minithread_workers; i++)
+	{
+		AbortOnCondition(pthread_create(&host, NULL, minithread_worker, &workers[i]) != 0,
+			"pthread");
+	}
+	pthread_sigmask(SIG_SETMASK, &oldSet, NULL);
+
+	minithread_switch(&hostStack, &mainThread->stack_top);	
 }
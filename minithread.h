@@ -3,6 +3,7 @@
 
 #include "machineprimitives.h"
 #include "alarm.h"
+#include "queue.h"
 
 /*
  * minithread.h:
@@ -16,13 +17,14 @@
 
 
 /*
- * sortedlist_t alarms
- * This is the key data structure for alarms. 
+ * timerwheel_t alarms
+ * This is the key data structure for alarms, a timing wheel counting
+ * ALARM_RESOLUTION ticks of CLOCK_MONOTONIC (alarm.h). 
  * It is in this file so that it can be referenced from both
  * alarm.c and minithread.c.
  */
 
-extern sortedlist_t alarms;
+extern timerwheel_t alarms;
 
 /*
  * This is the serial number of the current time quanta
@@ -35,6 +37,36 @@ extern int currentTime;
  */
 extern int QUANTA;
 
+/*
+ * This is the number of scheduler workers: host threads that each run
+ * minithreads from their own ready queue. Set it before calling
+ * minithread_system_initialize; it defaults to 1. The host thread that
+ * calls minithread_system_initialize is worker 0, and only worker 0
+ * advances currentTime and fires alarms.
+ */
+extern int minithread_workers;
+
+/*
+ * Set to 1 before calling minithread_system_initialize to run the clocks
+ * tickless: instead of interrupting every quantum, each worker's clock is
+ * programmed to go off only when its running thread's quantum expires with
+ * another thread waiting, and on worker 0 at least every so often to keep
+ * currentTime. Alarms have a clock of their own either way.
+ * Defaults to 0, a tick every quantum.
+ */
+extern int minithread_tickless;
+
+/*
+ * Set to 1 before calling minithread_system_initialize to take device
+ * interrupts (network, disk, keyboard) by polling instead of signals:
+ * devices queue them and write to an eventfd, and the scheduler runs their
+ * handlers whenever a thread stops, yields or exits, at each clock tick,
+ * and in the idle loop, which waits on the eventfd. A thread that computes
+ * alone without switching sees them at its next tick. The clock and alarms
+ * still interrupt. Defaults to 0, signals.
+ */
+extern int minithread_polled_io;
+
 /*
  * struct minithread:
  *  This is the key data structure for the thread management package.
@@ -43,17 +75,55 @@ extern int QUANTA;
 
 typedef struct minithread *minithread_t;
 
+/*
+ * Thread states, kept in status: running on a worker, in a ready queue, or
+ * neither (waiting on something, or not yet started).
+ */
+enum { MINITHREAD_RUNNING, MINITHREAD_READY, MINITHREAD_BLOCKED };
+
 struct minithread {
 	proc_t proc;
 	arg_t arg;
 	int status;
 	int id;
 	int level;
+	int cpuTicks; //quanta the thread has spent running
+	int levelTicks; //quanta run since the thread last changed level
+	int pinned; //kept at level 0: never demoted, so never aged either
+	int voluntarySwitches; //times the thread stopped or yielded
+	int involuntarySwitches; //times the clock preempted the thread
+	long statusSince; //minithread_cycles() when status last changed
+	long runCycles; //time spent in each status, up to statusSince
+	long readyCycles;
+	long blockedCycles;
 	int currentDirectoryInode;
-	stack_pointer_t *stack_base;
-	stack_pointer_t *stack_top;
+	stack_pointer_t stack_base;
+	stack_pointer_t stack_top;
+	stack_pointer_t stack_origin; //stack_top of the stack before the thread first ran
+	int stack_size;
+	int stack_guarded; //whether stack_base sits above a guard page
+	int worker; //the worker whose ready queue the thread joins when runnable
+	struct queue_link link; //Links the thread into the ready queue or a wait queue
+	struct queue_link allLink; //Links the thread into the list of live threads
 };
 
+/*
+ * A snapshot of a thread's scheduling statistics, see minithread_stats.
+ * Times are in nanoseconds.
+ */
+typedef struct minithread_stat {
+	int id;
+	int worker;
+	int level;
+	int status;
+	int cpuTicks;
+	int voluntarySwitches;
+	int involuntarySwitches;
+	long runNanos;
+	long readyNanos;
+	long blockedNanos;
+} minithread_stat_t;
+
 
 /*
  * minithread_t
@@ -64,7 +134,18 @@ struct minithread {
  */ 
 extern minithread_t minithread_fork(proc_t proc, arg_t arg);
 
-extern minithread_t runningThread;
+/*
+ * minithread_t
+ * minithread_fork_with_stack(proc_t proc, arg_t arg, int stack_size)
+ *  Like minithread_fork, but the thread runs on a stack of stack_size
+ *  bytes instead of the default STACKSIZE. Small stacks suit lightweight
+ *  workers; overflowing one faults on its guard page rather than
+ *  corrupting memory. Returns NULL, creating nothing, if stack_size is
+ *  not positive.
+ */
+extern minithread_t minithread_fork_with_stack(proc_t proc, arg_t arg, int stack_size);
+
+extern __thread minithread_t runningThread;
 
 
 /*
@@ -75,6 +156,14 @@ extern minithread_t runningThread;
  */
 extern minithread_t minithread_create(proc_t proc, arg_t arg);
 
+/*
+ * minithread_t
+ * minithread_create_with_stack(proc_t proc, arg_t arg, int stack_size)
+ *  Like minithread_fork_with_stack, only returned thread is not scheduled
+ *  for execution.
+ */
+extern minithread_t minithread_create_with_stack(proc_t proc, arg_t arg, int stack_size);
+
 
 
 /*
@@ -127,6 +216,37 @@ extern void minithread_system_initialize(proc_t mainproc, arg_t mainarg);
  */
 extern void minithread_sleep_with_timeout(int delay);
 
+/*
+ * uint64_t minithread_idle_time()
+ *      Return the number of milliseconds the idle threads of all workers
+ *      have spent parked waiting for an interrupt, i.e. host CPU time not
+ *      spent spinning.
+ */
+extern uint64_t minithread_idle_time();
+
+/*
+ * int minithread_stats(minithread_stat_t *stats, int max)
+ *      Fill stats with a snapshot of up to max live threads, not counting
+ *      the workers' idle threads, oldest first. Returns the number of live
+ *      threads, which may be more than max.
+ */
+extern int minithread_stats(minithread_stat_t *stats, int max);
+
+/*
+ * long minithread_cycles()
+ *      Return the processor's timestamp counter, the clock the scheduling
+ *      statistics are kept on because it is cheap enough to read on every
+ *      switch.
+ */
+extern long minithread_cycles();
+
+/*
+ * long minithread_cycles_to_nanos(long cycles)
+ *      Convert a number of timestamp counter cycles to nanoseconds, at the
+ *      rate the counter has run since minithread_system_initialize.
+ */
+extern long minithread_cycles_to_nanos(long cycles);
+
 
 #endif /*__MINITHREAD_H__*/
 
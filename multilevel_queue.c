@@ -4,7 +4,7 @@
 #include "multilevel_queue.h"
 #include <stdlib.h>
 #include <stdio.h>
-#include "random.h"
+#include <strings.h>
 
 /*
 Implement multilevel queues and use them to change your FCFS scheduler into a multilevel
@@ -16,42 +16,75 @@ for threads starting at level 0. Instead, the starting point should be varied in
 proportions 50%, 25%, 15% and 10% for levels 0 to 3 respectively.
 */
 
+/*
+ * Bit i of nonempty is set exactly when queues[i] has items in it, so the
+ * dequeue search is a find-first-set instead of a walk over the levels.
+ * This caps the number of levels at the number of bits in an unsigned int.
+ */
 struct multilevel_queue {
-	queue_t* queues;
+	struct intrusive_queue* queues;
 	int levels;
+	int linkOffset; //Offset of the queue_link within each item
+	int size; //Items across all levels
+	unsigned int nonempty; //Bitmap of non-empty levels
 };
 
+/*
+ * Starting levels for the scheduler, in the 50/25/15/10 proportions above.
+ * The order is the one stride scheduling produces for 10/5/3/2 tickets, so
+ * every level gets its share spread evenly over each round of 20 picks.
+ */
+#define LOTTERY_ROUND 20
+static const int lotteryTable[LOTTERY_ROUND] = {
+	0, 0, 1, 0, 2, 0, 1, 0, 3, 0,
+	1, 2, 0, 0, 1, 0, 0, 1, 2, 3
+};
+static int lotteryNext = 0;
+
 
 /*
- * Returns an empty multilevel queue with number_of_levels levels. On error should return NULL.
+ * Returns an empty multilevel queue with number_of_levels levels, holding items linked through
+ * the queue_link link_offset bytes into each item. On error should return NULL.
  */
-multilevel_queue_t multilevel_queue_new(int number_of_levels)
+multilevel_queue_t multilevel_queue_new(int number_of_levels, int link_offset)
 {
-	queue_t* queues; //Pointer for the queues
+	struct intrusive_queue* queues; //Pointer for the queues
 	int i; //Used in for loop
 
+	multilevel_queue_t newMultilevelQueue;
+
+	//The non-empty bitmap needs a bit per level
+	if (number_of_levels > sizeof(unsigned int) * 8)
+		return NULL;
+
 	//Malloc newMultilevelQueue
-	multilevel_queue_t newMultilevelQueue = (multilevel_queue_t) malloc(sizeof(struct multilevel_queue));
+	newMultilevelQueue = (multilevel_queue_t) malloc(sizeof(struct multilevel_queue));
 
 	//Ensures that newMultilevelQueue is properly initialized
 	if (newMultilevelQueue == NULL)
 		return NULL;
 
 	//Initialize pointer to queues
-	queues = (queue_t*) malloc(sizeof(queue_t) * number_of_levels);
+	queues = (struct intrusive_queue*) malloc(sizeof(struct intrusive_queue) * number_of_levels);
 
 	//Ensures that queues (array of secondary queue pointers) is properly initialized
 	if (queues == NULL)
+	{
+		free(newMultilevelQueue);
 		return NULL;
+	}
 
 	for (i = 0; i < number_of_levels; i++)
 	{
-		queues[i] = queue_new();
+		intrusive_queue_init(&queues[i]);
 	}
 
 	//Initialize newMultilevelQueue
 	newMultilevelQueue->levels = number_of_levels;
 	newMultilevelQueue->queues = queues;
+	newMultilevelQueue->linkOffset = link_offset;
+	newMultilevelQueue->size = 0;
+	newMultilevelQueue->nonempty = 0;
 
 	return (multilevel_queue_t) newMultilevelQueue;
 }
@@ -66,9 +99,12 @@ int multilevel_queue_enqueue(multilevel_queue_t queue, int level, void* item)
 	if (queue == NULL || queue->levels == 0 || level >= queue->levels || item == NULL)
 		return -1;
 
-	//Append item to the proper level queue in multilevel queue queue_append 
-	//will return sucess or failure based on ability to add item to queue
-	return queue_append(queue->queues[level], item);
+	//Link item into the proper level queue through its embedded queue_link
+	intrusive_queue_append(&queue->queues[level], (queue_link_t) ((char*) item + queue->linkOffset));
+	queue->nonempty |= (1u << level);
+	queue->size++;
+
+	return 0;
 }
 
 /*
@@ -79,44 +115,102 @@ int multilevel_queue_enqueue(multilevel_queue_t queue, int level, void* item)
  */
 int multilevel_queue_dequeue(multilevel_queue_t queue, int level, void** item)
 {
-	int found = 1;
-	int searchLevel = 0;
+	unsigned int fromLevel;
+	queue_link_t link;
+	int found;
 
 	//Ensure all arguments are valid - multilevel_queue & item are not null, levels exist in the queue
 	//and not attempting to add to a level that doesnt exist in the queue
 	if (queue == NULL || queue->levels == 0 || level < 0 || level >= queue->levels || item == NULL)
 		return -1;
 
-	//If found != 0 - void* not found yet, if searchLevel >= queue->levels - all levels searched for a void*
-	while(found != 0 && searchLevel < queue->levels)
+	if (queue->nonempty == 0)
 	{
-		//((searchLevel+level)%queue->levels) will start at level and loop back to level-1
-		//item will be set to the first void* in queue at the current level being searched
-		found = queue_dequeue(queue->queues[((searchLevel+level)%queue->levels)], item);
-		searchLevel++;
+		*item = NULL;
+		return -1;
 	}
 
-	//If found != 0, 
-	if (found != 0)
+	//Levels from level upwards are searched first, then the search wraps
+	//around to level 0
+	fromLevel = queue->nonempty & (~0u << level);
+	found = ffs(fromLevel != 0 ? fromLevel : queue->nonempty) - 1;
+
+	link = intrusive_queue_dequeue(&queue->queues[found]);
+	*item = (void*) ((char*) link - queue->linkOffset);
+	if (intrusive_queue_length(&queue->queues[found]) == 0)
+		queue->nonempty &= ~(1u << found);
+	queue->size--;
+
+	return found;
+}
+
+/*
+ * Dequeue the first void* of level only. Return level, or -1 and NULL if
+ * that level is empty.
+ */
+int multilevel_queue_take(multilevel_queue_t queue, int level, void** item)
+{
+	queue_link_t link;
+
+	if (queue == NULL || level < 0 || level >= queue->levels || item == NULL)
+		return -1;
+
+	if ((queue->nonempty & (1u << level)) == 0)
 	{
 		*item = NULL;
 		return -1;
 	}
 
-	//Return the level the first void* was on, must use searchLevel-1 as while loop will searchLevel++;
-	return (((searchLevel-1)+level)%queue->levels);
+	link = intrusive_queue_dequeue(&queue->queues[level]);
+	*item = (void*) ((char*) link - queue->linkOffset);
+	if (intrusive_queue_length(&queue->queues[level]) == 0)
+		queue->nonempty &= ~(1u << level);
+	queue->size--;
+
+	return level;
 }
 
+/*
+ * Remove the last void* from the highest priority non-empty level, the item
+ * that would run last there, and return its level. Return -1 and NULL if the
+ * multilevel queue is empty.
+ */
+int multilevel_queue_steal(multilevel_queue_t queue, void** item)
+{
+	queue_link_t link;
+	int found;
+
+	if (queue == NULL || item == NULL)
+		return -1;
+
+	if (queue->nonempty == 0)
+	{
+		*item = NULL;
+		return -1;
+	}
+
+	found = ffs(queue->nonempty) - 1;
+
+	link = queue->queues[found].rear;
+	intrusive_queue_delete(&queue->queues[found], link);
+	*item = (void*) ((char*) link - queue->linkOffset);
+	if (intrusive_queue_length(&queue->queues[found]) == 0)
+		queue->nonempty &= ~(1u << found);
+	queue->size--;
+
+	return found;
+}
+
+/*
+ * Return the level the scheduler should start searching from. Levels come
+ * from the precomputed lottery table rather than a random draw, so picking
+ * one costs an array lookup.
+ */
 int get_priority_of_thread()
 {
-	unsigned int x = genintrand(100);
-	if (x > 90)
-		return 3;
-	if (x > 75)
-		return 2;
-	if (x > 50)
-		return 1;
-	return 0;
+	int level = lotteryTable[lotteryNext];
+	lotteryNext = (lotteryNext + 1) % LOTTERY_ROUND;
+	return level;
 }
 
 
@@ -126,19 +220,11 @@ int get_priority_of_thread()
  */
 int multilevel_queue_free(multilevel_queue_t queue)
 {
-	int i; //Used in for loop
-
 	//Ensures that multilevel_queue is not null
 	if (queue == NULL)
 		return -1;
 
-	for (i = 0; i < queue->levels; i++)
-	{
-		//Just frees the queues not the items within
-		free(queue->queues[i]);
-	}
-
-	//Free malloced pointer
+	//Free malloced level queues, the items link themselves
 	free(queue->queues);
 	//Free multilevel_queue
 	free(queue);
@@ -148,17 +234,10 @@ int multilevel_queue_free(multilevel_queue_t queue)
 
 int multilevel_queue_length(multilevel_queue_t queue, int level)
 {
-	//queue_length will check if queue is null
-	return queue_length(queue->queues[level]);
+	return intrusive_queue_length(&queue->queues[level]);
 }
 
 int multilevel_queue_fulllength(multilevel_queue_t queue)
 {
-	int i;
-	int len = 0;
-	for (i = 0; i < queue->levels; i++)
-	{
-		len += multilevel_queue_length(queue, i);
-	}
-	return len;
+	return queue->size;
 }
@@ -15,9 +15,19 @@ typedef struct multilevel_queue* multilevel_queue_t;
 
 /*
  * Returns an empty multilevel queue with number_of_levels levels. On error should return NULL.
+ * At most 32 levels are supported.
+ *
+ * The queue is intrusive: every item must embed a struct queue_link, link_offset bytes from
+ * its start (use offsetof), which the queue links the item through. Enqueueing and dequeueing
+ * therefore never allocate, and an item can be on only one such queue at a time.
  */
-extern multilevel_queue_t multilevel_queue_new(int number_of_levels);
+extern multilevel_queue_t multilevel_queue_new(int number_of_levels, int link_offset);
 
+/*
+ * Returns the level the scheduler should start dequeueing from. Successive calls cycle
+ * through a fixed table giving levels 0 to 3 50%, 25%, 15% and 10% of the picks.
+ * The table's cursor is shared by every worker, so call with interrupts disabled.
+ */
 extern int get_priority_of_thread();
 
 
@@ -34,8 +44,22 @@ extern int multilevel_queue_enqueue(multilevel_queue_t queue, int level, void* i
  */
 extern int multilevel_queue_dequeue(multilevel_queue_t queue, int level, void** item);
 
+/*
+ * Dequeue and return the first void* of exactly the specified level, without searching other
+ * levels. Return level, or -1 (failure) and NULL if that level is empty.
+ */
+extern int multilevel_queue_take(multilevel_queue_t queue, int level, void** item);
+
+/*
+ * Remove and return the last void* of the highest priority (lowest numbered) non-empty level,
+ * for a scheduler taking work from another scheduler's queue: the item keeps its level but is
+ * the one its owner would have run last. Return the level the item was located on, or -1
+ * (failure) and NULL if the multilevel queue is empty.
+ */
+extern int multilevel_queue_steal(multilevel_queue_t queue, void** item);
+
 /* 
- * Free the queue and return 0 (success) or -1 (failure). Do not free the queue nodes; this is
+ * Free the queue and return 0 (success) or -1 (failure). Do not free the items; this is
  * the responsibility of the programmer.
  */
 extern int multilevel_queue_free(multilevel_queue_t queue);
@@ -43,6 +67,7 @@ extern int multilevel_queue_free(multilevel_queue_t queue);
 //Returns length of queue[level] in multilevel queue
 extern int multilevel_queue_length(multilevel_queue_t queue, int level);
 
+//Returns the number of items across all levels of the multilevel queue
 extern int multilevel_queue_fulllength(multilevel_queue_t queue);
 
 #endif /*__MULTILEVEL_QUEUE_H__*/
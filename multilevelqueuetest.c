@@ -5,16 +5,24 @@
 
 int z;
 
+//Items link themselves into the multilevel queue
+struct item {
+	int value;
+	struct queue_link link;
+};
+
 int
 main(int argc, char *argv[])
 {
 	//Multilevel_queue with 4 (four) levels
-	multilevel_queue_t queue = multilevel_queue_new(4);
+	multilevel_queue_t queue = multilevel_queue_new(4, offsetof(struct item, link));
 	int i;
 	int j;
-	int *x;
-	int *p;
+	struct item *x;
+	struct item *p;
+	struct item single;
 	void** item = (void **) &p;
+	int picks[4] = {0, 0, 0, 0};
 
 	x = 0;
 
@@ -23,8 +31,8 @@ main(int argc, char *argv[])
 	{
 		for (j = 0; j < 3; j++)
 		{
-			x = (int *) malloc(sizeof(int));
-			*x = (j*i);	
+			x = (struct item *) malloc(sizeof(struct item));
+			x->value = (j*i);	
 			multilevel_queue_enqueue(queue, i, x);
 		}
 	}	
@@ -56,5 +64,51 @@ main(int argc, char *argv[])
 	z = multilevel_queue_free(queue);
 	assert(z == 0);
 
+	//Search wraps around to lower levels
+	queue = multilevel_queue_new(4, offsetof(struct item, link));
+	multilevel_queue_enqueue(queue, 0, &single);
+	z = multilevel_queue_dequeue(queue, 3, item);
+	assert(z == 0 && p == &single);
+	z = multilevel_queue_fulllength(queue);
+	assert(z == 0);
+	z = multilevel_queue_dequeue(queue, 0, item);
+	assert(z == -1 && p == NULL);
+	multilevel_queue_free(queue);
+
+	//Stealing takes the back of the highest priority level
+	queue = multilevel_queue_new(4, offsetof(struct item, link));
+	x = (struct item *) malloc(sizeof(struct item) * 3);
+	multilevel_queue_enqueue(queue, 2, &x[0]);
+	multilevel_queue_enqueue(queue, 1, &x[1]);
+	multilevel_queue_enqueue(queue, 1, &x[2]);
+	z = multilevel_queue_steal(queue, item);
+	assert(z == 1 && p == &x[2]);
+	z = multilevel_queue_steal(queue, item);
+	assert(z == 1 && p == &x[1]);
+	z = multilevel_queue_dequeue(queue, 0, item);
+	assert(z == 2 && p == &x[0]);
+	z = multilevel_queue_steal(queue, item);
+	assert(z == -1 && p == NULL);
+	z = multilevel_queue_fulllength(queue);
+	assert(z == 0);
+	multilevel_queue_free(queue);
+	free(x);
+
+	//Taking a level does not search the others
+	queue = multilevel_queue_new(4, offsetof(struct item, link));
+	multilevel_queue_enqueue(queue, 2, &single);
+	z = multilevel_queue_take(queue, 3, item);
+	assert(z == -1 && p == NULL);
+	z = multilevel_queue_take(queue, 2, item);
+	assert(z == 2 && p == &single);
+	z = multilevel_queue_fulllength(queue);
+	assert(z == 0);
+	multilevel_queue_free(queue);
+
+	//Starting levels come out in 50/25/15/10 proportions
+	for (i = 0; i < 100; i++)
+		picks[get_priority_of_thread()]++;
+	assert(picks[0] == 50 && picks[1] == 25 && picks[2] == 15 && picks[3] == 10);
+
 	return 0;
 }
@@ -66,6 +66,13 @@ struct address_info {
 struct address_info if_info;
 static network_address_t broadcast_addr = { 0 };
 
+/*
+ * Our own address, resolved once by network_initialize: gethostbyname is
+ * slow, and not safe to call from several host threads at once.
+ */
+static network_address_t my_addr_cache;
+static int my_addr_known = 0;
+
 /* forward definition */
 void start_network_poll(interrupt_handler_t, int*);
 void network_address_to_sockaddr(network_address_t addr, struct sockaddr_in* sin);
@@ -156,6 +163,10 @@ network_send_pkt(network_address_t dest_address, int hdr_len,
 void
 network_get_my_address(network_address_t my_address) {
   char hostname[64];
+  if (my_addr_known) {
+    network_address_copy(my_addr_cache, my_address);
+    return;
+  }
   assert(gethostname(hostname, 64) == 0);
   network_translate_hostname(hostname, my_address);
   my_address[1] = htons(my_udp_port);
@@ -504,6 +515,9 @@ network_initialize(network_handler_t network_handler) {
   }
 
 
+  network_get_my_address(my_addr_cache);
+  my_addr_known = 1;
+
   if (BCAST_ENABLED)
     bcast_initialize(BCAST_TOPOLOGY_FILE, &topology);
 
@@ -265,3 +265,81 @@ queue_delete(queue_t queue, void* item) {
 	//else
 	return -1;
 }
+
+/*
+ * Make queue an empty intrusive queue.
+ */
+void
+intrusive_queue_init(intrusive_queue_t queue) {
+	queue->size = 0;
+	queue->front = NULL;
+	queue->rear = NULL;
+}
+
+/*
+ * Append the item linked by link to the end of the intrusive queue.
+ */
+void
+intrusive_queue_append(intrusive_queue_t queue, queue_link_t link) {
+	link->next = NULL;
+	link->prev = queue->rear;
+
+	if (queue->rear == NULL)
+		queue->front = link;
+	else
+		queue->rear->next = link;
+
+	queue->rear = link;
+	queue->size++;
+}
+
+/*
+ * Dequeue and return the link of the first item in the intrusive queue,
+ * or NULL if it is empty.
+ */
+queue_link_t
+intrusive_queue_dequeue(intrusive_queue_t queue) {
+	queue_link_t frontLink = queue->front;
+
+	if (frontLink == NULL)
+		return NULL;
+
+	queue->front = frontLink->next;
+	if (queue->front != NULL)
+		queue->front->prev = NULL;
+	else
+		queue->rear = NULL;
+
+	frontLink->next = NULL;
+	queue->size--;
+
+	return frontLink;
+}
+
+/*
+ * Unlink the item linked by link from the intrusive queue.
+ */
+void
+intrusive_queue_delete(intrusive_queue_t queue, queue_link_t link) {
+	if (link->prev != NULL)
+		link->prev->next = link->next;
+	else
+		queue->front = link->next;
+
+	if (link->next != NULL)
+		link->next->prev = link->prev;
+	else
+		queue->rear = link->prev;
+
+	link->next = NULL;
+	link->prev = NULL;
+	queue->size--;
+}
+
+/*
+ * Return the number of items in the intrusive queue.
+ */
+int
+intrusive_queue_length(intrusive_queue_t queue) {
+	return queue->size;
+}
@@ -4,6 +4,8 @@
 #ifndef __QUEUE_H__
 #define __QUEUE_H__
 
+#include <stddef.h>
+
 /*
  * queue_t is a pointer to an internally maintained data structure.
  * Clients of this package do not need to know how queues are
@@ -66,4 +68,57 @@ extern int queue_length(queue_t queue);
  */
 extern int queue_delete(queue_t queue, void* item);
 
+/*
+ * Intrusive queues.
+ *  An intrusive queue links its items through a struct queue_link embedded
+ *  in the item itself, so appending and dequeueing never allocate. Unlike
+ *  queue_t, the queue head can be embedded in another structure as well.
+ *  An item can be on only one intrusive queue at a time per embedded link.
+ */
+typedef struct queue_link* queue_link_t;
+typedef struct intrusive_queue* intrusive_queue_t;
+
+struct queue_link {
+	struct queue_link* next;
+	struct queue_link* prev;
+};
+
+struct intrusive_queue {
+	int size;
+	struct queue_link* front;
+	struct queue_link* rear;
+};
+
+/*
+ * Return the item containing the queue_link link, given the item's type and
+ * the name of the link field within it.
+ */
+#define queue_entry(link, type, member) \
+	((type*) ((char*) (link) - offsetof(type, member)))
+
+/*
+ * Make queue an empty intrusive queue.
+ */
+extern void intrusive_queue_init(intrusive_queue_t queue);
+
+/*
+ * Append the item linked by link to the end of the queue.
+ */
+extern void intrusive_queue_append(intrusive_queue_t queue, queue_link_t link);
+
+/*
+ * Dequeue and return the link of the first item, or NULL if queue is empty.
+ */
+extern queue_link_t intrusive_queue_dequeue(intrusive_queue_t queue);
+
+/*
+ * Unlink the item linked by link, which must be on the queue.
+ */
+extern void intrusive_queue_delete(intrusive_queue_t queue, queue_link_t link);
+
+/*
+ * Return the number of items in the intrusive queue.
+ */
+extern int intrusive_queue_length(intrusive_queue_t queue);
+
 #endif /*__QUEUE_H__*/
@@ -10,6 +10,11 @@
 
 int x = 0;
 
+struct item {
+	int value;
+	struct queue_link link;
+};
+
 void iter(void *cur, void *ptr) {
 	x += 1;
 }	
@@ -22,6 +27,9 @@ main(void) {
 	int **iptr;
 	int a = 0, b = 1, c = 2;
 	int f;
+	struct intrusive_queue iqueue;
+	struct item items[3];
+	queue_link_t link;
 	queue_append(testqueue, &a);
 	queue_append(testqueue, &b);
 	queue_append(testqueue, &c);
@@ -46,6 +54,24 @@ main(void) {
 	iptr = (int **) ptr;
 	if (**iptr != 5)
 		printf("Prepend test failed. Expected 5, got %d\n", **iptr);
+
+	//Intrusive queue tests
+	intrusive_queue_init(&iqueue);
+	for (f = 0; f < 3; f++) {
+		items[f].value = f;
+		intrusive_queue_append(&iqueue, &items[f].link);
+	}
+	if (intrusive_queue_length(&iqueue) != 3)
+		printf("Intrusive length test failed\n");
+	intrusive_queue_delete(&iqueue, &items[1].link);
+	link = intrusive_queue_dequeue(&iqueue);
+	if (queue_entry(link, struct item, link)->value != 0)
+		printf("Intrusive dequeue test failed\n");
+	link = intrusive_queue_dequeue(&iqueue);
+	if (queue_entry(link, struct item, link)->value != 2)
+		printf("Intrusive delete test failed\n");
+	if (intrusive_queue_dequeue(&iqueue) != NULL || intrusive_queue_length(&iqueue) != 0)
+		printf("Intrusive empty test failed\n");
 	return 0;
 }
 
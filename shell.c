@@ -131,6 +131,33 @@ int inputfile(char *fname) {
 	return 0;
 }
 
+//list the live threads and their scheduling statistics
+int ps() {
+	char *states[] = { "run", "ready", "block" };
+	minithread_stat_t *stats;
+	int max = 64;
+	int n;
+	int i;
+
+	//retry with room for all of them if there are more than we guessed
+	for(;;) {
+		stats = malloc(sizeof(minithread_stat_t) * max);
+		if(stats == NULL) { printf("ps: out of memory\n"); return -1; }
+		n = minithread_stats(stats, max);
+		if(n <= max) break;
+		free(stats);
+		max = n;
+	}
+	printf("  ID  WKR LVL STATE  TICKS    VOL  INVOL    RUN(ms)  READY(ms) BLOCKED(ms)\n");
+	for(i = 0; i < n; i++)
+		printf("%4d %4d %3d %-5s %6d %6d %6d %10ld %10ld %11ld\n",
+			stats[i].id, stats[i].worker, stats[i].level, states[stats[i].status],
+			stats[i].cpuTicks, stats[i].voluntarySwitches, stats[i].involuntarySwitches,
+			stats[i].runNanos / 1000000, stats[i].readyNanos / 1000000,
+			stats[i].blockedNanos / 1000000);
+	free(stats);
+	return 0;
+}
 
 void help_screen() {
 	printf("Supported commands:\n");
@@ -147,6 +174,8 @@ void help_screen() {
 	printf(" cp (copy) src dest - copy src file to dest file\n");
 	printf(" mv (move) src dest - move src file to dest file\n");
 	printf(" whoami - print your identity\n");
+	printf(" ps - list threads with their CPU, wait and switch counts\n");
+	printf(" sync - write cached changes to disk\n");
 	printf(" help - show this screen\n");
 	printf(" exit - exit shell\n");
 	printf("\n");
@@ -208,6 +237,10 @@ int shell(int *g) {
 			move(arg1,arg2);
 		else if(strcmp(func,"whoami") == 0)
 			printf("You are minithread %d, running our shell\n",minithread_id());
+		else if(strcmp(func,"ps") == 0)
+			ps();
+		else if(strcmp(func,"sync") == 0)
+			minifile_sync();
 		else if(strcmp(func,"exit") == 0)
 			break;
 		else if(strcmp(func,"doscmd") == 0)
@@ -223,11 +256,15 @@ int shell(int *g) {
 		}
 		else printf("%s: Command not found\n",func);
 	}
+	minifile_sync();
 	printf("Good-bye :-)\n");
 	return 0;
 }
 
 int main(int argc, char** argv) {
+    minifile_write_back = 1;
+    // to record the data blocks used, for cachesim
+    minifile_block_trace = getenv("MINIFILE_BLOCK_TRACE");
     minithread_system_initialize(shell, NULL);
     return -1;
 }
@@ -13,19 +13,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "minithread.h"
-#include "synch.h"
+#include "channel.h"
 
 #define MAXPRIME 1000000
 
-typedef struct {
-  int value;
-  semaphore_t produce;
-  semaphore_t consume;
-} channel_t;
+/* values are passed down the pipeline this many at a time */
+#define BATCH 64
+#define CHANNEL_CAPACITY 256
+
+/* filters only shuttle ints between channels, so a small stack will do */
+#define FILTER_STACK_SIZE (16 * 1024)
 
 typedef struct {
-  channel_t* left;
-  channel_t* right;
+  channel_t left;
+  channel_t right;
   int prime;
 } filter_t;
 
@@ -34,77 +35,69 @@ int max = MAXPRIME;
 
 /* produce all integers from 2 to max */
 int source(int* arg) {
-  channel_t* c = (channel_t *) arg;
+  channel_t c = (channel_t) arg;
+  void* batch[BATCH];
+  int n = 0;
   int i;
 
   for (i=2; i<=max; i++) {
-    c->value = i;
-    semaphore_V(c->consume);
-    semaphore_P(c->produce);
+    batch[n++] = (void *) (long) i;
+    if (n == BATCH || i == max) {
+      channel_send_batch(c, batch, n);
+      n = 0;
+    }
   }
-  
-  c->value = -1;
-  semaphore_V(c->consume);
+
+  channel_close(c);
 
   return 0;
 }
 
 int filter(int* arg) {
   filter_t* f = (filter_t *) arg;
-  int value;
-
-  for (;;) {
-    semaphore_P(f->left->consume);
-    value = f->left->value;
-    semaphore_V(f->left->produce);
-    if ((value == -1) || (value % f->prime != 0)) {
-      f->right->value = value;
-      semaphore_V(f->right->consume);
-      semaphore_P(f->right->produce);
-    }
-    if (value == -1)
-      break;
+  void* in[BATCH];
+  void* out[BATCH];
+  int received;
+  int passed;
+  int i;
+
+  while ((received = channel_receive_batch(f->left, in, BATCH)) > 0) {
+    passed = 0;
+    for (i = 0; i < received; i++)
+      if ((long) in[i] % f->prime != 0)
+        out[passed++] = in[i];
+    if (passed > 0)
+      channel_send_batch(f->right, out, passed);
   }
 
+  channel_close(f->right);
+  channel_destroy(f->left);
+  free(f);
+
   return 0;
 }
 
 int sink(int* arg) {
-  channel_t* p = (channel_t *) malloc(sizeof(channel_t));
-  int value;
-
-  p->produce = semaphore_create();
-  semaphore_initialize(p->produce, 0);
-  p->consume = semaphore_create();
-  semaphore_initialize(p->consume, 0);
+  channel_t p = channel_create(CHANNEL_CAPACITY);
+  void* value;
 
   minithread_fork(source, (int *) p);
   
-  for (;;) {
+  /* values are taken one at a time: those after a prime must go through
+     the filter for it, which reads from p from then on */
+  while (channel_receive(p, &value) == 0) {
     filter_t* f;
 
-    semaphore_P(p->consume);
-    value = p->value;
-    semaphore_V(p->produce);
-    
-    if (value == -1)
-      break;
-
-    printf("%d is prime.\n", value);
+    printf("%ld is prime.\n", (long) value);
     
     f = (filter_t *) malloc(sizeof(filter_t));
     f->left = p;
-    f->prime = value;
-    
-    p = (channel_t *) malloc(sizeof(channel_t));
-    p->produce = semaphore_create();
-    semaphore_initialize(p->produce, 0);
-    p->consume = semaphore_create();
-    semaphore_initialize(p->consume, 0);
+    f->prime = (int) (long) value;
     
+    p = channel_create(CHANNEL_CAPACITY);
     f->right = p;
 
-    minithread_fork(filter, (int *) f);
+    minithread_fork_with_stack(filter, (int *) f, FILTER_STACK_SIZE);
   }
 
   return 0;
@@ -112,6 +105,9 @@ int sink(int* arg) {
 
 int
 main(int argc, char * argv[]) {
+  /* optional argument: number of scheduler workers */
+  if (argc > 1)
+    minithread_workers = atoi(argv[1]);
   minithread_system_initialize(sink, NULL);
   return -1;
 }
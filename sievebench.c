@@ -0,0 +1,264 @@
+/* sievebench.c
+
+   Sieve pipeline benchmark. Runs the prime sieve of sieve.c over the
+   integers up to MAXPRIME twice, each in its own process since the
+   minithread system can only be initialized once: once handing values
+   between stages one at a time on a pair of semaphores, and once moving
+   them through bounded channels in batches. Each run stops at MAXPRIME or
+   after SECONDS seconds, whichever comes first, and reports how far it
+   got. Throughput is the values received by pipeline stages per second,
+   which unlike the integers sieved per second does not favour the run
+   that got less far, where there are fewer stages to go through.
+
+   usage: sievebench [workers]
+*/
+
+#include "minithread.h"
+#include "synch.h"
+#include "channel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define MAXPRIME 1000000
+#define SECONDS 20
+
+#define BATCH 64
+#define CHANNEL_CAPACITY 256
+#define FILTER_STACK_SIZE (16 * 1024)
+
+struct result {
+  int primes;
+  int largest;
+  long moved;
+  int ms;
+};
+
+int result;
+long moved; /* values received by filters and the sink */
+uint64_t startTime;
+
+/* hand the result back to the parent through the pipe */
+void report(int primes, int largest) {
+  struct result r;
+
+  r.primes = primes;
+  r.largest = largest;
+  r.moved = moved;
+  r.ms = (int) (currentTimeMillis() - startTime);
+  write(result, &r, sizeof(r));
+  exit(0);
+}
+
+int out_of_time() {
+  return currentTimeMillis() - startTime >= SECONDS * 1000;
+}
+
+/* single-value handoffs on two semaphores, as sieve.c used to */
+
+typedef struct {
+  int value;
+  semaphore_t produce;
+  semaphore_t consume;
+} handoff_t;
+
+typedef struct {
+  handoff_t* left;
+  handoff_t* right;
+  int prime;
+} handoff_filter_t;
+
+handoff_t* handoff_create() {
+  handoff_t* h = (handoff_t *) malloc(sizeof(handoff_t));
+
+  h->produce = semaphore_create();
+  semaphore_initialize(h->produce, 0);
+  h->consume = semaphore_create();
+  semaphore_initialize(h->consume, 0);
+  return h;
+}
+
+int handoff_source(int* arg) {
+  handoff_t* c = (handoff_t *) arg;
+  int i;
+
+  for (i = 2; i <= MAXPRIME; i++) {
+    c->value = i;
+    semaphore_V(c->consume);
+    semaphore_P(c->produce);
+  }
+
+  c->value = -1;
+  semaphore_V(c->consume);
+  return 0;
+}
+
+int handoff_filter(int* arg) {
+  handoff_filter_t* f = (handoff_filter_t *) arg;
+  int value;
+
+  for (;;) {
+    semaphore_P(f->left->consume);
+    value = f->left->value;
+    semaphore_V(f->left->produce);
+    __sync_fetch_and_add(&moved, 1);
+    if ((value == -1) || (value % f->prime != 0)) {
+      f->right->value = value;
+      semaphore_V(f->right->consume);
+      semaphore_P(f->right->produce);
+    }
+    if (value == -1)
+      break;
+  }
+  return 0;
+}
+
+int handoff_sink(int* arg) {
+  handoff_t* p = handoff_create();
+  handoff_filter_t* f;
+  int primes = 0;
+  int value = 0;
+
+  startTime = currentTimeMillis();
+  minithread_fork(handoff_source, (int *) p);
+
+  for (;;) {
+    semaphore_P(p->consume);
+    __sync_fetch_and_add(&moved, 1);
+    if (p->value == -1 || out_of_time())
+      break;
+    value = p->value;
+    semaphore_V(p->produce);
+    primes++;
+
+    f = (handoff_filter_t *) malloc(sizeof(handoff_filter_t));
+    f->left = p;
+    f->prime = value;
+    p = handoff_create();
+    f->right = p;
+    minithread_fork_with_stack(handoff_filter, (int *) f, FILTER_STACK_SIZE);
+  }
+
+  report(primes, value);
+  return 0;
+}
+
+/* batches through channels, as sieve.c does now */
+
+typedef struct {
+  channel_t left;
+  channel_t right;
+  int prime;
+} channel_filter_t;
+
+int channel_source(int* arg) {
+  channel_t c = (channel_t) arg;
+  void* batch[BATCH];
+  int n = 0;
+  int i;
+
+  for (i = 2; i <= MAXPRIME; i++) {
+    batch[n++] = (void *) (long) i;
+    if (n == BATCH || i == MAXPRIME) {
+      channel_send_batch(c, batch, n);
+      n = 0;
+    }
+  }
+
+  channel_close(c);
+  return 0;
+}
+
+int channel_filter(int* arg) {
+  channel_filter_t* f = (channel_filter_t *) arg;
+  void* in[BATCH];
+  void* out[BATCH];
+  int received;
+  int passed;
+  int i;
+
+  while ((received = channel_receive_batch(f->left, in, BATCH)) > 0) {
+    __sync_fetch_and_add(&moved, received);
+    passed = 0;
+    for (i = 0; i < received; i++)
+      if ((long) in[i] % f->prime != 0)
+        out[passed++] = in[i];
+    if (passed > 0)
+      channel_send_batch(f->right, out, passed);
+  }
+
+  channel_close(f->right);
+  return 0;
+}
+
+int channel_sink(int* arg) {
+  channel_t p = channel_create(CHANNEL_CAPACITY);
+  channel_filter_t* f;
+  void* value;
+  int primes = 0;
+  int largest = 0;
+
+  startTime = currentTimeMillis();
+  minithread_fork(channel_source, (int *) p);
+
+  while (channel_receive(p, &value) == 0 && !out_of_time()) {
+    __sync_fetch_and_add(&moved, 1);
+    primes++;
+    largest = (int) (long) value;
+
+    f = (channel_filter_t *) malloc(sizeof(channel_filter_t));
+    f->left = p;
+    f->prime = largest;
+    p = channel_create(CHANNEL_CAPACITY);
+    f->right = p;
+    minithread_fork_with_stack(channel_filter, (int *) f, FILTER_STACK_SIZE);
+  }
+
+  report(primes, largest);
+  return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+  proc_t sinks[2] = { handoff_sink, channel_sink };
+  char* names[2] = { "handoff", "channel" };
+  struct result r;
+  double baseline = 0;
+  double rate;
+  int fds[2];
+  int i;
+
+  if (argc > 1)
+    minithread_workers = atoi(argv[1]);
+
+  printf("sieving up to %d for at most %d seconds\n", MAXPRIME, SECONDS);
+  printf("pipeline  primes  largest     ms  values/s  speedup\n");
+  for (i = 0; i < 2; i++) {
+    if (pipe(fds) != 0)
+      return -1;
+    fflush(stdout);
+    if (fork() == 0) {
+      close(fds[0]);
+      result = fds[1];
+      minithread_system_initialize(sinks[i], NULL);
+      return -1;
+    }
+    close(fds[1]);
+    if (read(fds[0], &r, sizeof(r)) != sizeof(r))
+      r.primes = r.largest = r.ms = r.moved = 0;
+    close(fds[0]);
+    wait(NULL);
+
+    if (r.ms <= 0)
+      r.ms = 1;
+    rate = (double) r.moved * 1000 / r.ms;
+    if (i == 0)
+      baseline = rate;
+    printf("%-8s %7d %8d %6d %9.0f %8.2f\n", names[i], r.primes, r.largest, r.ms, rate,
+        baseline > 0 ? rate / baseline : 0);
+  }
+
+  return 0;
+}
@@ -0,0 +1,200 @@
+/* statstest.c
+
+   Tests of the per-thread scheduling statistics from minithread_stats.
+   Threads spin, ping-pong on semaphores and sleep, then wait while a
+   snapshot is taken. Each failure is printed, and the exit status is the
+   number of failures.
+*/
+
+#include "minithread.h"
+#include "synch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WORKERS 1
+
+/* more spinners than workers, so that they preempt each other however
+   many processors the host has */
+#define SPINNERS (WORKERS + 1)
+#define SPIN_MS 300
+#define ROUNDS 1000
+#define SLEEP_MS 100
+
+/* the spinners, the ping-pong pair and the sleeper */
+#define THREADS (SPINNERS + 3)
+#define PINGER SPINNERS
+#define PONGER (SPINNERS + 1)
+#define SLEEPER (SPINNERS + 2)
+
+/* nanoseconds, or parts in 1000 of a lifetime, its times may be off by */
+#define SLACK_NANOS 100000
+#define SLACK_PARTS 10
+
+semaphore_t finished;
+semaphore_t hold;
+semaphore_t ping;
+semaphore_t pong;
+int failures = 0;
+
+int ids[THREADS];
+long forked[THREADS];
+
+void fail(char* test, int thread, char* what) {
+  printf("%s test failed for thread %d: %s\n", test, thread, what);
+  failures++;
+}
+
+/* wait for count threads to V finished */
+void join(int count) {
+  while (count-- > 0)
+    semaphore_P(finished);
+}
+
+/* report this thread as done, and stay alive for the snapshot */
+void finish(int* arg) {
+  ids[(long) arg] = minithread_id();
+  semaphore_V(finished);
+  semaphore_P(hold);
+}
+
+int spinner(int* arg) {
+  uint64_t end = currentTimeMillis() + SPIN_MS;
+  volatile int sink = 0;
+
+  while (currentTimeMillis() < end)
+    sink++;
+
+  finish(arg);
+  return 0;
+}
+
+int pinger(int* arg) {
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    semaphore_V(ping);
+    semaphore_P(pong);
+  }
+
+  finish(arg);
+  return 0;
+}
+
+int ponger(int* arg) {
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    semaphore_P(ping);
+    semaphore_V(pong);
+  }
+
+  finish(arg);
+  return 0;
+}
+
+int sleeper(int* arg) {
+  minithread_sleep_with_timeout(SLEEP_MS);
+
+  finish(arg);
+  return 0;
+}
+
+void fork_timed(proc_t proc, int i) {
+  forked[i] = minithread_cycles();
+  minithread_fork(proc, (int *) (long) i);
+}
+
+/* the snapshot of the thread with id, or NULL */
+minithread_stat_t* find_stat(minithread_stat_t* stats, int count, int id) {
+  int i;
+
+  for (i = 0; i < count; i++)
+    if (stats[i].id == id)
+      return &stats[i];
+  return NULL;
+}
+
+int tests(int* arg) {
+  minithread_stat_t stats[THREADS + 8];
+  minithread_stat_t* s;
+  long taken;
+  long lifetime;
+  long total;
+  long spinning = 0;
+  int involuntary = 0;
+  int count;
+  int i;
+
+  finished = semaphore_create();
+  semaphore_initialize(finished, 0);
+  hold = semaphore_create();
+  semaphore_initialize(hold, 0);
+  ping = semaphore_create();
+  semaphore_initialize(ping, 0);
+  pong = semaphore_create();
+  semaphore_initialize(pong, 0);
+
+  for (i = 0; i < SPINNERS; i++)
+    fork_timed(spinner, i);
+  fork_timed(pinger, PINGER);
+  fork_timed(ponger, PONGER);
+  fork_timed(sleeper, SLEEPER);
+  join(THREADS);
+
+  count = minithread_stats(stats, THREADS + 8);
+  taken = minithread_cycles();
+  if (count > THREADS + 8)
+    count = THREADS + 8;
+
+  s = find_stat(stats, count, minithread_id());
+  if (s == NULL || s->status != MINITHREAD_RUNNING)
+    fail("Status", minithread_id(), "the thread taking the snapshot was not running");
+
+  for (i = 0; i < THREADS; i++) {
+    s = find_stat(stats, count, ids[i]);
+    if (s == NULL) {
+      fail("Snapshot", ids[i], "missing");
+      continue;
+    }
+    if (s->status != MINITHREAD_BLOCKED)
+      fail("Status", ids[i], "not blocked while held");
+
+    /* every moment of a thread's life is run, ready or blocked time */
+    lifetime = minithread_cycles_to_nanos(taken - forked[i]);
+    total = s->runNanos + s->readyNanos + s->blockedNanos;
+    if (total > lifetime || total < lifetime - SLACK_NANOS - lifetime / 1000 * SLACK_PARTS)
+      fail("Lifetime", ids[i], "run, ready and blocked times do not add up to its lifetime");
+
+    if (i < SPINNERS) {
+      involuntary += s->involuntarySwitches;
+      spinning += s->runNanos;
+    }
+    else if (i == PINGER || i == PONGER) {
+      if (s->voluntarySwitches < ROUNDS)
+        fail("Ping-pong", ids[i], "fewer voluntary switches than rounds");
+      if (s->blockedNanos == 0)
+        fail("Ping-pong", ids[i], "no blocked time");
+    }
+    else if (i == SLEEPER) {
+      if (s->blockedNanos < (SLEEP_MS - 10) * 1000000L)
+        fail("Sleeper", ids[i], "blocked for less than it slept");
+    }
+  }
+  /* the worker was busy with a spinner for most of the time they spun */
+  if (spinning < SPIN_MS * 1000000L / 2)
+    fail("Spinner", 0, "spinners were counted too little run time");
+  if (involuntary == 0)
+    fail("Spinner", 0, "spinners competing for the worker were never preempted");
+
+  printf("%d failures\n", failures);
+  exit(failures);
+  return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+  minithread_workers = WORKERS;
+  minithread_system_initialize(tests, NULL);
+  return -1;
+}
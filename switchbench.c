@@ -0,0 +1,83 @@
+/* switchbench.c
+
+   Context switch microbenchmark. Measures the throughput of two threads
+   yielding to each other, and of two threads ping-ponging on a pair of
+   semaphores.
+*/
+
+#include "minithread.h"
+#include "synch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ROUNDS 1000000
+
+semaphore_t ping;
+semaphore_t pong;
+semaphore_t done;
+
+int yielder(int* arg) {
+  int i;
+
+  for (i = 0; i < ROUNDS; i++)
+    minithread_yield();
+
+  semaphore_V(done);
+  return 0;
+}
+
+int ponger(int* arg) {
+  int i;
+
+  for (i = 0; i < ROUNDS; i++) {
+    semaphore_P(ping);
+    semaphore_V(pong);
+  }
+
+  return 0;
+}
+
+void report(char* name, uint64_t elapsed) {
+  if (elapsed == 0)
+    elapsed = 1;
+  printf("%s: %d switches in %d ms, %.0f switches/s\n", name, 2 * ROUNDS,
+         (int) elapsed, (2.0 * ROUNDS * 1000) / elapsed);
+}
+
+int bench(int* arg) {
+  uint64_t start;
+  int i;
+
+  ping = semaphore_create();
+  semaphore_initialize(ping, 0);
+  pong = semaphore_create();
+  semaphore_initialize(pong, 0);
+  done = semaphore_create();
+  semaphore_initialize(done, 0);
+
+  /* two yielders switch to each other while this thread is blocked */
+  start = currentTimeMillis();
+  minithread_fork(yielder, NULL);
+  minithread_fork(yielder, NULL);
+  semaphore_P(done);
+  semaphore_P(done);
+  report("yield", currentTimeMillis() - start);
+
+  start = currentTimeMillis();
+  minithread_fork(ponger, NULL);
+  for (i = 0; i < ROUNDS; i++) {
+    semaphore_V(ping);
+    semaphore_P(pong);
+  }
+  report("semaphore ping-pong", currentTimeMillis() - start);
+
+  exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+  minithread_system_initialize(bench, NULL);
+  return -1;
+}
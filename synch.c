@@ -7,6 +7,7 @@
 #include "synch.h"
 #include "queue.h"
 #include "minithread.h"
+#include "trace.h"
 
 /*
  *      You must implement the procedures and types defined in this interface.
@@ -16,8 +17,10 @@
  * Semaphores.
  */
 struct semaphore {
-	int count; //maximum number of clients
-	queue_t waitQueue; //clients waiting
+	int count; //maximum number of clients; below 0, minus the clients waiting
+	struct intrusive_queue waitQueue; //clients waiting, linked through their minithread
+	int waits; //times a client had to wait
+	long waitCycles; //total time clients spent waiting, see minithread_cycles
 };
 
 
@@ -31,7 +34,9 @@ semaphore_t semaphore_create() {
 	if (newSemaphore == NULL)
 		return NULL;
 
-	newSemaphore->waitQueue = queue_new();
+	intrusive_queue_init(&newSemaphore->waitQueue);
+	newSemaphore->waits = 0;
+	newSemaphore->waitCycles = 0;
 
     return (semaphore_t) newSemaphore;
 }
@@ -41,8 +46,7 @@ semaphore_t semaphore_create() {
  *      Deallocate a semaphore.
  */
 void semaphore_destroy(semaphore_t sem) {
-	queue_free(sem->waitQueue); //Free waitQueue
-	free(sem); //Free semaphore itself
+	free(sem); //Free semaphore, waitQueue is embedded
 }
 
 /*
@@ -54,6 +58,56 @@ void semaphore_initialize(semaphore_t sem, int cnt) {
 	sem->count = cnt;
 }
 
+/*
+ * The count is changed by compare-and-swap, so that P on a positive count
+ * and V with nobody waiting leave the kernel lock alone. Only a P that has
+ * to wait, or a V that has a waiter to start, takes the lock; waiters are
+ * queued and dequeued under it.
+ */
+
+/*
+ * Take one from sem's count if it is positive, without the kernel lock.
+ * Returns 1 if taken.
+ */
+static int semaphore_take(semaphore_t sem) {
+	int count;
+
+	while ((count = sem->count) > 0)
+		if (compare_and_swap(&sem->count, count, count - 1) == count)
+			return 1;
+	return 0;
+}
+
+/*
+ * Add delta to sem's count, racing the lock-free paths, and return the new
+ * count.
+ */
+static int semaphore_add(semaphore_t sem, int delta) {
+	int count;
+
+	do
+		count = sem->count;
+	while (compare_and_swap(&sem->count, count, count + delta) != count);
+	return count + delta;
+}
+
+/*
+ * Wait on sem until started again, and charge the time to sem. Interrupts
+ * must be disabled, and are disabled again on return.
+ */
+static void semaphore_wait(semaphore_t sem) {
+	minithread_t self = minithread_self();
+	long blocked = self->blockedCycles;
+
+	intrusive_queue_append(&sem->waitQueue, &self->link);
+	TRACE(TRACE_BLOCK, self->id, sem);
+	minithread_stop();
+	//Threads are switched back to with interrupts enabled
+	set_interrupt_level(DISABLED);
+	sem->waits++;
+	sem->waitCycles += self->blockedCycles - blocked;
+}
+
 /*
  * semaphore_P(semaphore_t sem)
  *      P on the sempahore.
@@ -62,19 +116,125 @@ void semaphore_P(semaphore_t sem) {
 	//Holder for last interrupt level
 	interrupt_level_t previousLevel;
 
+	if (semaphore_take(sem))
+		return;
+
 	//Disable interrupts
 	//Interrupts are disabled so that if we context switch away the alarm will
 	//not be triggered before semaphore_P is called and will not hang forever
 	previousLevel = set_interrupt_level(DISABLED);
 
-	if(--(sem->count) < 0)
+	//A V may have come since, in which case we need not wait after all
+	if (semaphore_add(sem, -1) < 0)
+		semaphore_wait(sem);
+
+	//Restore the previous interrupt level 
+	set_interrupt_level(previousLevel);
+}
+
+/*
+ * A thread waiting in semaphore_P_timeout, for the alarm that gives up
+ * the wait. Lives on the waiting thread's stack.
+ */
+struct semaphore_timeout {
+	semaphore_t sem;
+	minithread_t thread;
+	int expired; //set if the alarm took the thread off the semaphore
+};
+
+/*
+ * Alarm handler giving up a semaphore_P_timeout, unless a V has already
+ * taken the thread off the wait queue. Runs with interrupts disabled.
+ */
+static void semaphore_timeout_expire(void *arg) {
+	struct semaphore_timeout *timeout = (struct semaphore_timeout *) arg;
+	queue_link_t link;
+
+	for (link = timeout->sem->waitQueue.front; link != NULL; link = link->next)
 	{
-		queue_append(sem->waitQueue, (void*) minithread_self());
-		minithread_stop();
+		if (link == &timeout->thread->link)
+		{
+			intrusive_queue_delete(&timeout->sem->waitQueue, link);
+			semaphore_add(timeout->sem, 1);
+			timeout->expired = 1;
+			TRACE(TRACE_WAKE, timeout->thread->id, timeout->sem);
+			minithread_start(timeout->thread);
+			return;
+		}
 	}
+}
+
+/*
+ * semaphore_P_timeout(semaphore_t sem, int timeout)
+ *      P on the sempahore, giving up after timeout milliseconds.
+ */
+int semaphore_P_timeout(semaphore_t sem, int timeout) {
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+	struct semaphore_timeout expiry;
+	alarm_id alarm;
+
+	if (semaphore_take(sem))
+		return 0;
+	if (timeout <= 0)
+		return -1;
+
+	previousLevel = set_interrupt_level(DISABLED);
+
+	//The alarm cannot fire before we are on the queue, as it needs
+	//interrupts enabled
+	expiry.sem = sem;
+	expiry.thread = minithread_self();
+	expiry.expired = 0;
+	alarm = register_alarm(timeout, &semaphore_timeout_expire, &expiry);
+	//Without an alarm nothing would end the wait, so do not start it
+	if (alarm == NULL)
+	{
+		set_interrupt_level(previousLevel);
+		return -1;
+	}
+
+	//A V may have come since the alarm was registered
+	if (semaphore_add(sem, -1) >= 0)
+	{
+		deregister_alarm(alarm);
+		set_interrupt_level(previousLevel);
+		return 0;
+	}
+	semaphore_wait(sem);
+
+	//Woken by a V: the alarm must not outlive expiry. If it fires before
+	//it is cancelled, it no longer finds us on the queue.
+	if (!expiry.expired)
+		deregister_alarm(alarm);
 
 	//Restore the previous interrupt level 
 	set_interrupt_level(previousLevel);
+
+	return expiry.expired ? -1 : 0;
+}
+
+/*
+ * semaphore_try_P(semaphore_t sem)
+ *      P on the sempahore if that can be done without waiting.
+ */
+int semaphore_try_P(semaphore_t sem) {
+	return semaphore_P_timeout(sem, 0);
+}
+
+/*
+ * semaphore_stats(semaphore_t sem, int *waits, long *waitNanos)
+ *      Report how often and how long threads have waited on the semaphore.
+ */
+void semaphore_stats(semaphore_t sem, int *waits, long *waitNanos) {
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+
+	previousLevel = set_interrupt_level(DISABLED);
+	*waits = sem->waits;
+	*waitNanos = sem->waitCycles;
+	set_interrupt_level(previousLevel);
+	*waitNanos = minithread_cycles_to_nanos(*waitNanos);
 }
 
 /*
@@ -84,19 +244,366 @@ void semaphore_P(semaphore_t sem) {
 void semaphore_V(semaphore_t sem) {
 	//Holder for last interrupt level
 	interrupt_level_t previousLevel;
+	int count;
+
+	//Nobody waiting, so nobody to start
+	while ((count = sem->count) >= 0)
+		if (compare_and_swap(&sem->count, count, count + 1) == count)
+			return;
 
 	//Disable interrupts
 	//Interrupts are disabled so that if we context switch away the alarm will
 	//not be triggered before semaphore_P is called and will not hang forever
 	previousLevel = set_interrupt_level(DISABLED);
 
-	if(++(sem->count) <= 0)
+	if (semaphore_add(sem, 1) <= 0)
 	{
-		minithread_t minithread; //Minithread obtained in next line from dequeue
+		queue_link_t link = intrusive_queue_dequeue(&sem->waitQueue);
+		minithread_t thread = queue_entry(link, struct minithread, link);
+
+		TRACE(TRACE_WAKE, thread->id, sem);
+		minithread_start(thread);
+	}
+
+	//Restore the previous interrupt level 
+	set_interrupt_level(previousLevel);
+}
+
+/*
+ * Mutexes.
+ */
+#define MUTEX_UNLOCKED 0
+#define MUTEX_LOCKED 1
+#define MUTEX_CONTENDED 2 //locked, and there may be threads waiting
+
+struct mutex {
+	int state; //MUTEX_UNLOCKED, MUTEX_LOCKED or MUTEX_CONTENDED
+	minithread_t owner; //thread holding the mutex, for debugging
+	struct intrusive_queue waitQueue; //threads waiting, linked through their minithread
+};
 
-		queue_dequeue(sem->waitQueue, (void**) &minithread);
 
-		minithread_start(minithread);
+/*
+ * mutex_t mutex_create()
+ *      Allocate a new, unlocked mutex.
+ */
+mutex_t mutex_create() {
+	mutex_t newMutex = (mutex_t) malloc(sizeof(struct mutex));
+
+	if (newMutex == NULL)
+		return NULL;
+
+	newMutex->state = MUTEX_UNLOCKED;
+	newMutex->owner = NULL;
+	intrusive_queue_init(&newMutex->waitQueue);
+
+	return newMutex;
+}
+
+/*
+ * mutex_destroy(mutex_t mutex);
+ *      Deallocate a mutex.
+ */
+void mutex_destroy(mutex_t mutex) {
+	assert(mutex->owner == NULL);
+	free(mutex); //Free mutex, waitQueue is embedded
+}
+
+/*
+ * mutex_lock(mutex_t mutex)
+ *      Lock the mutex.
+ */
+void mutex_lock(mutex_t mutex) {
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+
+	//Uncontended, the mutex is taken without touching the kernel lock
+	if (compare_and_swap(&mutex->state, MUTEX_UNLOCKED, MUTEX_LOCKED) != MUTEX_UNLOCKED)
+	{
+		previousLevel = set_interrupt_level(DISABLED);
+
+		//Marking the mutex contended makes its holder take the slow path
+		//to unlock it, and so wake us. If it was unlocked in the meantime
+		//we hold it instead, and its next unlock looks for waiters.
+		while (swap(&mutex->state, MUTEX_CONTENDED) != MUTEX_UNLOCKED)
+		{
+			intrusive_queue_append(&mutex->waitQueue, &minithread_self()->link);
+			minithread_stop();
+			//Threads are switched back to with interrupts enabled
+			set_interrupt_level(DISABLED);
+		}
+
+		//Restore the previous interrupt level 
+		set_interrupt_level(previousLevel);
+	}
+
+	mutex->owner = minithread_self();
+}
+
+/*
+ * mutex_unlock(mutex_t mutex)
+ *      Unlock the mutex.
+ */
+void mutex_unlock(mutex_t mutex) {
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+	queue_link_t link;
+
+	assert(mutex->owner == minithread_self());
+	mutex->owner = NULL;
+
+	//Nobody has marked the mutex contended, so nobody is waiting
+	if (compare_and_swap(&mutex->state, MUTEX_LOCKED, MUTEX_UNLOCKED) != MUTEX_LOCKED)
+	{
+		//Waiters enqueue themselves with interrupts disabled, so every
+		//thread that marked the mutex contended is in the queue by now
+		previousLevel = set_interrupt_level(DISABLED);
+
+		//The woken thread competes for the mutex afresh, marking it
+		//contended again if there are more waiters behind it
+		swap(&mutex->state, MUTEX_UNLOCKED);
+		link = intrusive_queue_dequeue(&mutex->waitQueue);
+		if (link != NULL)
+			minithread_start(queue_entry(link, struct minithread, link));
+
+		//Restore the previous interrupt level 
+		set_interrupt_level(previousLevel);
+	}
+}
+
+/*
+ * Condition variables.
+ */
+struct condition {
+	struct intrusive_queue waitQueue; //threads waiting, linked through their minithread
+};
+
+
+/*
+ * condition_t condition_create()
+ *      Allocate a new condition variable.
+ */
+condition_t condition_create() {
+	condition_t newCondition = (condition_t) malloc(sizeof(struct condition));
+
+	if (newCondition == NULL)
+		return NULL;
+
+	intrusive_queue_init(&newCondition->waitQueue);
+
+	return newCondition;
+}
+
+/*
+ * condition_destroy(condition_t cond);
+ *      Deallocate a condition variable.
+ */
+void condition_destroy(condition_t cond) {
+	assert(intrusive_queue_length(&cond->waitQueue) == 0);
+	free(cond); //Free condition, waitQueue is embedded
+}
+
+/*
+ * condition_wait(condition_t cond, mutex_t mutex)
+ *      Wait on the condition variable.
+ */
+void condition_wait(condition_t cond, mutex_t mutex) {
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+
+	//Joining the queue before unlocking the mutex, with interrupts
+	//disabled throughout, means a signal sent once the mutex is unlocked
+	//finds us waiting
+	previousLevel = set_interrupt_level(DISABLED);
+	intrusive_queue_append(&cond->waitQueue, &minithread_self()->link);
+	mutex_unlock(mutex);
+	minithread_stop();
+
+	//Restore the previous interrupt level 
+	set_interrupt_level(previousLevel);
+
+	//cond is not touched again, so it may be destroyed once we are woken
+	mutex_lock(mutex);
+}
+
+/*
+ * condition_signal(condition_t cond)
+ *      Wake one thread waiting on the condition variable.
+ */
+void condition_signal(condition_t cond) {
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+	queue_link_t link;
+
+	previousLevel = set_interrupt_level(DISABLED);
+
+	link = intrusive_queue_dequeue(&cond->waitQueue);
+	if (link != NULL)
+		minithread_start(queue_entry(link, struct minithread, link));
+
+	//Restore the previous interrupt level 
+	set_interrupt_level(previousLevel);
+}
+
+/*
+ * condition_broadcast(condition_t cond)
+ *      Wake every thread waiting on the condition variable.
+ */
+void condition_broadcast(condition_t cond) {
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+	queue_link_t link;
+
+	//All the waiters are made runnable under a single disabling of
+	//interrupts, rather than one per waiter
+	previousLevel = set_interrupt_level(DISABLED);
+
+	while ((link = intrusive_queue_dequeue(&cond->waitQueue)) != NULL)
+		minithread_start(queue_entry(link, struct minithread, link));
+
+	//Restore the previous interrupt level 
+	set_interrupt_level(previousLevel);
+}
+
+/*
+ * Reader-writer locks.
+ *
+ * Unlocking hands the lock straight to the threads it wakes, counting them
+ * as holders before they run, so nobody can slip in ahead of them.
+ */
+struct rwlock {
+	int readers; //threads holding the lock to read
+	int writer; //1 if a thread holds the lock to write
+	struct intrusive_queue readQueue; //readers waiting, linked through their minithread
+	struct intrusive_queue writeQueue; //writers waiting, linked through their minithread
+};
+
+
+/*
+ * rwlock_t rwlock_create()
+ *      Allocate a new, unlocked reader-writer lock.
+ */
+rwlock_t rwlock_create() {
+	rwlock_t newLock = (rwlock_t) malloc(sizeof(struct rwlock));
+
+	if (newLock == NULL)
+		return NULL;
+
+	newLock->readers = 0;
+	newLock->writer = 0;
+	intrusive_queue_init(&newLock->readQueue);
+	intrusive_queue_init(&newLock->writeQueue);
+
+	return newLock;
+}
+
+/*
+ * rwlock_destroy(rwlock_t lock);
+ *      Deallocate a reader-writer lock.
+ */
+void rwlock_destroy(rwlock_t lock) {
+	assert(lock->readers == 0 && lock->writer == 0);
+	free(lock); //Free lock, queues are embedded
+}
+
+/*
+ * rwlock_read_lock(rwlock_t lock)
+ *      Lock for reading.
+ */
+void rwlock_read_lock(rwlock_t lock) {
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+
+	previousLevel = set_interrupt_level(DISABLED);
+
+	//Readers queue behind waiting writers, so a stream of readers
+	//cannot keep a writer out forever
+	if (lock->writer || intrusive_queue_length(&lock->writeQueue) > 0)
+	{
+		intrusive_queue_append(&lock->readQueue, &minithread_self()->link);
+		minithread_stop();
+	}
+	else
+		lock->readers++;
+
+	//Restore the previous interrupt level 
+	set_interrupt_level(previousLevel);
+}
+
+/*
+ * rwlock_read_unlock(rwlock_t lock)
+ *      Unlock a lock held for reading.
+ */
+void rwlock_read_unlock(rwlock_t lock) {
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+	queue_link_t link;
+
+	previousLevel = set_interrupt_level(DISABLED);
+
+	assert(lock->readers > 0);
+	if (--lock->readers == 0 && intrusive_queue_length(&lock->writeQueue) > 0)
+	{
+		link = intrusive_queue_dequeue(&lock->writeQueue);
+		lock->writer = 1;
+		minithread_start(queue_entry(link, struct minithread, link));
+	}
+
+	//Restore the previous interrupt level 
+	set_interrupt_level(previousLevel);
+}
+
+/*
+ * rwlock_write_lock(rwlock_t lock)
+ *      Lock for writing.
+ */
+void rwlock_write_lock(rwlock_t lock) {
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+
+	previousLevel = set_interrupt_level(DISABLED);
+
+	if (lock->writer || lock->readers > 0)
+	{
+		intrusive_queue_append(&lock->writeQueue, &minithread_self()->link);
+		minithread_stop();
+	}
+	else
+		lock->writer = 1;
+
+	//Restore the previous interrupt level 
+	set_interrupt_level(previousLevel);
+}
+
+/*
+ * rwlock_write_unlock(rwlock_t lock)
+ *      Unlock a lock held for writing.
+ */
+void rwlock_write_unlock(rwlock_t lock) {
+	//Holder for last interrupt level
+	interrupt_level_t previousLevel;
+	queue_link_t link;
+
+	previousLevel = set_interrupt_level(DISABLED);
+
+	assert(lock->writer);
+	lock->writer = 0;
+
+	//Every reader that waited for this writer goes next, ahead of the
+	//writers queued behind it
+	if (intrusive_queue_length(&lock->readQueue) > 0)
+	{
+		while ((link = intrusive_queue_dequeue(&lock->readQueue)) != NULL)
+		{
+			lock->readers++;
+			minithread_start(queue_entry(link, struct minithread, link));
+		}
+	}
+	else if (intrusive_queue_length(&lock->writeQueue) > 0)
+	{
+		link = intrusive_queue_dequeue(&lock->writeQueue);
+		lock->writer = 1;
+		minithread_start(queue_entry(link, struct minithread, link));
 	}
 
 	//Restore the previous interrupt level 
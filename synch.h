@@ -8,6 +8,9 @@
  */
 
 typedef struct semaphore *semaphore_t;
+typedef struct mutex *mutex_t;
+typedef struct condition *condition_t;
+typedef struct rwlock *rwlock_t;
 
 
 /*
@@ -40,6 +43,30 @@ extern void semaphore_initialize(semaphore_t sem, int cnt);
  */
 extern void semaphore_P(semaphore_t sem);
 
+/*
+ * semaphore_P_timeout(semaphore_t sem, int timeout)
+ *  P on the semaphore, giving up after timeout milliseconds. Returns 0 if
+ *  the semaphore was taken, or -1 if the timeout expired first, or if the
+ *  alarm for it could not be made, in which case it did not wait. A
+ *  timeout of 0 or less does not wait at all.
+ */
+extern int semaphore_P_timeout(semaphore_t sem, int timeout);
+
+/*
+ * semaphore_try_P(semaphore_t sem)
+ *  P on the semaphore if that can be done without waiting. Returns 0 if
+ *  the semaphore was taken, or -1 otherwise.
+ */
+extern int semaphore_try_P(semaphore_t sem);
+
+/*
+ * semaphore_stats(semaphore_t sem, int *waits, long *waitNanos)
+ *  Report in *waits how many P's on the semaphore had to wait, and in
+ *  *waitNanos the total nanoseconds they waited before a V (or their
+ *  timeout) let them go, for finding contended semaphores.
+ */
+extern void semaphore_stats(semaphore_t sem, int *waits, long *waitNanos);
+
 /*
  * semaphore_V(semaphore_t sem)
  *  V on the sempahore.
@@ -47,4 +74,125 @@ extern void semaphore_P(semaphore_t sem);
 extern void semaphore_V(semaphore_t sem);
 
 
+/*
+ * Mutexes.
+ *
+ *  A mutex is held by at most one thread, which must be the one to unlock
+ *  it. Locking and unlocking a mutex nobody is waiting on is a single
+ *  atomic instruction; interrupts are only disabled under contention.
+ */
+
+/*
+ * mutex_t mutex_create()
+ *  Allocate a new, unlocked mutex.
+ */
+extern mutex_t mutex_create();
+
+/*
+ * mutex_destroy(mutex_t mutex);
+ *  Deallocate a mutex. Nobody may hold or be waiting on it.
+ */
+extern void mutex_destroy(mutex_t mutex);
+
+/*
+ * mutex_lock(mutex_t mutex)
+ *  Lock the mutex, waiting for its holder to unlock it if need be.
+ */
+extern void mutex_lock(mutex_t mutex);
+
+/*
+ * mutex_unlock(mutex_t mutex)
+ *  Unlock the mutex, which the calling thread must hold.
+ */
+extern void mutex_unlock(mutex_t mutex);
+
+
+/*
+ * Condition variables.
+ *
+ *  A condition variable lets threads holding a mutex wait for a change to
+ *  the state it protects, made by another thread holding the same mutex.
+ *  Waiters are woken in the order they waited.
+ */
+
+/*
+ * condition_t condition_create()
+ *  Allocate a new condition variable with no waiters.
+ */
+extern condition_t condition_create();
+
+/*
+ * condition_destroy(condition_t cond);
+ *  Deallocate a condition variable. Threads that have been woken need not
+ *  have run yet, but none may still be waiting.
+ */
+extern void condition_destroy(condition_t cond);
+
+/*
+ * condition_wait(condition_t cond, mutex_t mutex)
+ *  Unlock mutex, which the calling thread must hold, and wait on cond,
+ *  atomically with respect to condition_signal and condition_broadcast.
+ *  mutex is locked again before returning.
+ */
+extern void condition_wait(condition_t cond, mutex_t mutex);
+
+/*
+ * condition_signal(condition_t cond)
+ *  Wake the thread that has waited longest on cond, if any.
+ */
+extern void condition_signal(condition_t cond);
+
+/*
+ * condition_broadcast(condition_t cond)
+ *  Wake every thread waiting on cond.
+ */
+extern void condition_broadcast(condition_t cond);
+
+
+/*
+ * Reader-writer locks.
+ *
+ *  A reader-writer lock is held either by any number of readers or by a
+ *  single writer. Neither side starves the other: a reader arriving while
+ *  a writer waits waits behind it, and a writer unlocking admits every
+ *  reader waiting at that point before the next writer.
+ */
+
+/*
+ * rwlock_t rwlock_create()
+ *  Allocate a new, unlocked reader-writer lock.
+ */
+extern rwlock_t rwlock_create();
+
+/*
+ * rwlock_destroy(rwlock_t lock);
+ *  Deallocate a reader-writer lock. Nobody may hold or be waiting on it.
+ */
+extern void rwlock_destroy(rwlock_t lock);
+
+/*
+ * rwlock_read_lock(rwlock_t lock)
+ *  Lock for reading, alongside any other readers.
+ */
+extern void rwlock_read_lock(rwlock_t lock);
+
+/*
+ * rwlock_read_unlock(rwlock_t lock)
+ *  Unlock a lock held for reading by the calling thread.
+ */
+extern void rwlock_read_unlock(rwlock_t lock);
+
+/*
+ * rwlock_write_lock(rwlock_t lock)
+ *  Lock for writing, excluding every other thread.
+ */
+extern void rwlock_write_lock(rwlock_t lock);
+
+/*
+ * rwlock_write_unlock(rwlock_t lock)
+ *  Unlock a lock held for writing by the calling thread.
+ */
+extern void rwlock_write_unlock(rwlock_t lock);
+
+
 #endif /*__SYNCH_H__*/
@@ -0,0 +1,325 @@
+/* synchtest.c
+
+   Tests of the synchronization primitives in synch.h, run on several
+   scheduler workers with preemption on. Each failure is printed, and the
+   exit status is the number of failures.
+*/
+
+#include "minithread.h"
+#include "synch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WORKERS 4
+
+/* threads, and rounds of each, contending for a mutex */
+#define LOCKERS 8
+#define INCREMENTS 2000
+/* iterations spent holding it, long enough to be preempted in */
+#define SPIN 2000
+
+/* threads waiting on a condition variable */
+#define WAITERS 6
+
+/* readers keeping a reader-writer lock busy, and writes made meanwhile */
+#define READERS 6
+#define WRITES 5
+/* milliseconds a writer may wait before it counts as starved */
+#define STARVED 5000
+
+/* milliseconds a semaphore_P_timeout waits, and tries at racing a V with
+   its expiry */
+#define TIMEOUT 100
+#define RACES 20
+
+semaphore_t finished;
+int failures = 0;
+
+mutex_t mutex;
+int counter;
+int holders;
+int overlaps;
+
+condition_t cond;
+int waiting;
+int woken;
+
+rwlock_t lock;
+int readersIn;
+int mostReaders;
+int writersIn;
+int stop;
+
+semaphore_t sem;
+
+void fail(char* test, char* what) {
+  printf("%s test failed: %s\n", test, what);
+  failures++;
+}
+
+/* wait for count threads to V finished */
+void join(int count) {
+  while (count-- > 0)
+    semaphore_P(finished);
+}
+
+/* spend a while, without switching away */
+void spin(int iterations) {
+  volatile int sink = 0;
+  int i;
+
+  for (i = 0; i < iterations; i++)
+    sink += i;
+}
+
+/* increments counter non-atomically, with the mutex held */
+int locker(int* arg) {
+  int seen;
+  int i;
+
+  for (i = 0; i < INCREMENTS; i++) {
+    mutex_lock(mutex);
+    if (++holders != 1)
+      overlaps++;
+    seen = counter;
+    spin(SPIN);
+    counter = seen + 1;
+    holders--;
+    mutex_unlock(mutex);
+  }
+
+  semaphore_V(finished);
+  return 0;
+}
+
+void test_mutex() {
+  int i;
+
+  mutex = mutex_create();
+  counter = 0;
+  holders = 0;
+  overlaps = 0;
+  for (i = 0; i < LOCKERS; i++)
+    minithread_fork(locker, NULL);
+  join(LOCKERS);
+
+  if (overlaps != 0)
+    fail("Mutex", "two threads held the mutex at once");
+  if (counter != LOCKERS * INCREMENTS)
+    fail("Mutex", "increments were lost");
+  mutex_destroy(mutex);
+}
+
+/* waits on cond once, and counts being woken */
+int waiter(int* arg) {
+  mutex_lock(mutex);
+  waiting++;
+  condition_wait(cond, mutex);
+  woken++;
+  mutex_unlock(mutex);
+
+  semaphore_V(finished);
+  return 0;
+}
+
+void test_condition() {
+  int i;
+
+  mutex = mutex_create();
+  cond = condition_create();
+  waiting = 0;
+  woken = 0;
+  for (i = 0; i < WAITERS; i++)
+    minithread_fork(waiter, NULL);
+
+  /* condition_wait unlocks the mutex, so every waiter is waiting once
+     they have all counted themselves and the mutex is free */
+  mutex_lock(mutex);
+  while (waiting < WAITERS) {
+    mutex_unlock(mutex);
+    minithread_yield();
+    mutex_lock(mutex);
+  }
+  condition_signal(cond);
+  mutex_unlock(mutex);
+
+  /* give any extra wakeups time to happen */
+  join(1);
+  minithread_sleep_with_timeout(100);
+  mutex_lock(mutex);
+  if (woken != 1)
+    fail("Condition", "signal did not wake exactly one waiter");
+  condition_broadcast(cond);
+  mutex_unlock(mutex);
+
+  join(WAITERS - 1);
+  if (woken != WAITERS)
+    fail("Condition", "broadcast did not wake every waiter");
+
+  /* with nobody waiting, neither is remembered for a later waiter */
+  waiting = 0;
+  mutex_lock(mutex);
+  condition_signal(cond);
+  condition_broadcast(cond);
+  mutex_unlock(mutex);
+  minithread_fork(waiter, NULL);
+  minithread_sleep_with_timeout(100);
+  mutex_lock(mutex);
+  if (waiting != 1 || woken != WAITERS)
+    fail("Condition", "a waiter was woken by a signal made before it waited");
+  condition_signal(cond);
+  mutex_unlock(mutex);
+  join(1);
+
+  condition_destroy(cond);
+  mutex_destroy(mutex);
+}
+
+/* takes the lock for reading over and over, until stop */
+int reader(int* arg) {
+  int in;
+
+  while (!stop) {
+    rwlock_read_lock(lock);
+    in = __sync_add_and_fetch(&readersIn, 1);
+    if (in > mostReaders)
+      mostReaders = in;
+    if (writersIn != 0)
+      overlaps++;
+    spin(SPIN);
+    __sync_sub_and_fetch(&readersIn, 1);
+    rwlock_read_unlock(lock);
+  }
+
+  semaphore_V(finished);
+  return 0;
+}
+
+int writer(int* arg) {
+  rwlock_write_lock(lock);
+  if (++writersIn != 1 || readersIn != 0)
+    overlaps++;
+  spin(SPIN);
+  writersIn--;
+  rwlock_write_unlock(lock);
+
+  semaphore_V(finished);
+  return 0;
+}
+
+void test_rwlock() {
+  int i;
+
+  lock = rwlock_create();
+  readersIn = 0;
+  mostReaders = 0;
+  writersIn = 0;
+  overlaps = 0;
+  stop = 0;
+  for (i = 0; i < READERS; i++)
+    minithread_fork(reader, NULL);
+  minithread_sleep_with_timeout(50);
+
+  /* the readers always overlap, so a writer only gets in if arriving
+     readers wait behind it */
+  for (i = 0; i < WRITES; i++) {
+    minithread_fork(writer, NULL);
+    if (semaphore_P_timeout(finished, STARVED) != 0) {
+      fail("Rwlock", "a writer starved while readers kept arriving");
+      break;
+    }
+  }
+
+  stop = 1;
+  join(i < WRITES ? READERS + 1 : READERS);
+  if (overlaps != 0)
+    fail("Rwlock", "a writer held the lock alongside another thread");
+  if (mostReaders < 2)
+    fail("Rwlock", "readers never shared the lock");
+  rwlock_destroy(lock);
+}
+
+/* Vs sem after the given number of milliseconds */
+int late_V(int* arg) {
+  minithread_sleep_with_timeout((long) arg);
+  semaphore_V(sem);
+
+  semaphore_V(finished);
+  return 0;
+}
+
+void test_semaphore() {
+  uint64_t start;
+  uint64_t elapsed;
+  int taken;
+  int i;
+
+  sem = semaphore_create();
+  semaphore_initialize(sem, 0);
+  if (semaphore_try_P(sem) != -1)
+    fail("Semaphore", "try_P took a semaphore of count 0");
+  semaphore_V(sem);
+  semaphore_V(sem);
+  if (semaphore_try_P(sem) != 0 || semaphore_try_P(sem) != 0)
+    fail("Semaphore", "try_P did not take a semaphore of positive count");
+  if (semaphore_try_P(sem) != -1)
+    fail("Semaphore", "try_P took more than the count");
+
+  start = currentTimeMillis();
+  if (semaphore_P_timeout(sem, TIMEOUT) != -1)
+    fail("Semaphore", "P_timeout took a semaphore nobody Ved");
+  elapsed = currentTimeMillis() - start;
+  if (elapsed < TIMEOUT / 2 || elapsed > 10 * TIMEOUT)
+    fail("Semaphore", "P_timeout did not wait out its timeout");
+  if (semaphore_P_timeout(sem, 0) != -1)
+    fail("Semaphore", "P_timeout of 0 took a semaphore of count 0");
+
+  minithread_fork(late_V, (int *) (TIMEOUT / 5));
+  start = currentTimeMillis();
+  if (semaphore_P_timeout(sem, 50 * TIMEOUT) != 0)
+    fail("Semaphore", "P_timeout timed out though the semaphore was Ved");
+  elapsed = currentTimeMillis() - start;
+  if (elapsed > 10 * TIMEOUT)
+    fail("Semaphore", "P_timeout was not woken by a V");
+  join(1);
+
+  /* whichever of the V and the expiry wins, the V is counted exactly
+     once: taken by the P, or left in the semaphore. The V comes just
+     before, at, or just after the expiry. */
+  for (i = 0; i < RACES; i++) {
+    minithread_fork(late_V, (int *) (long) (TIMEOUT / 5 - 1 + i % 3));
+    taken = semaphore_P_timeout(sem, TIMEOUT / 5) == 0;
+    join(1);
+    if (semaphore_try_P(sem) != (taken ? -1 : 0)) {
+      fail("Semaphore", "a V racing a P_timeout's expiry was lost");
+      break;
+    }
+    if (semaphore_try_P(sem) != -1) {
+      fail("Semaphore", "a V racing a P_timeout's expiry was counted twice");
+      break;
+    }
+  }
+  semaphore_destroy(sem);
+}
+
+int tests(int* arg) {
+  finished = semaphore_create();
+  semaphore_initialize(finished, 0);
+
+  test_mutex();
+  test_condition();
+  test_rwlock();
+  test_semaphore();
+
+  printf("%d failures\n", failures);
+  exit(failures);
+  return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+  minithread_workers = WORKERS;
+  minithread_system_initialize(tests, NULL);
+  return -1;
+}
@@ -0,0 +1,340 @@
+/*
+ * Hierarchical timing wheel manipulation functions
+ */
+#include "timerwheel.h"
+#include "queue.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SLOTS (1 << TIMERWHEEL_SLOT_BITS)
+#define SLOT_MASK (SLOTS - 1)
+//Furthest a deadline can be from the wheel's time
+#define SPAN ((1L << (TIMERWHEEL_SLOT_BITS * TIMERWHEEL_LEVELS)) - 1)
+
+//Timers are allocated this many at a time and never freed
+#define CHUNK_SIZE 64
+
+/*
+ * A timer sits in the slot of the lowest level whose slots are wide enough
+ * to reach its deadline, or the end of the span if that is sooner. When the
+ * wheel's time enters the range a slot covers, its timers are cascaded down
+ * a level, until they reach level 0, where each slot is a single tick and
+ * firing the slot fires them.
+ *
+ * Timers are recycled through a free list. Each records its index among
+ * all timers and a generation that changes whenever it is recycled; a
+ * timer_id_t packs the two, so an id outlives its timer harmlessly.
+ */
+struct timer {
+	long deadline;
+	long period; //0 unless the timer is periodic
+	void (*func)(void*);
+	void* arg;
+	unsigned int generation;
+	unsigned int index;
+	intrusive_queue_t slot; //The slot the timer is in, NULL if free
+	struct queue_link link; //Links the timer into its slot or the free list
+};
+
+struct timerwheel {
+	long now; //Every timer with a deadline up to now has fired
+	int size; //Timers in the wheel
+	struct intrusive_queue slots[TIMERWHEEL_LEVELS][SLOTS];
+	uint64_t occupied[TIMERWHEEL_LEVELS]; //Bitmap of non-empty slots per level
+	struct timer** chunks;
+	int chunkCount;
+	struct intrusive_queue freeTimers;
+	struct timer* firing; //The timer whose function is running, if any
+};
+
+
+//HELPER FUNCTIONS
+/*
+ * Return the slot index deadline falls in at level.
+ */
+static int
+timerwheel_slot_index(long deadline, int level)
+{
+	return (deadline >> (TIMERWHEEL_SLOT_BITS * level)) & SLOT_MASK;
+}
+
+/*
+ * Put timer in the slot for its deadline, relative to the wheel's time.
+ */
+static void
+timerwheel_place(timerwheel_t wheel, struct timer* timer)
+{
+	long at = timer->deadline - wheel->now > SPAN ? wheel->now + SPAN : timer->deadline;
+	long delta = at - wheel->now;
+	int level = 0;
+	int index;
+
+	while (level < TIMERWHEEL_LEVELS - 1 && delta >= (1L << (TIMERWHEEL_SLOT_BITS * (level + 1))))
+		level++;
+
+	index = timerwheel_slot_index(at, level);
+	timer->slot = &wheel->slots[level][index];
+	intrusive_queue_append(timer->slot, &timer->link);
+	wheel->occupied[level] |= (1ull << index);
+}
+
+/*
+ * Take timer out of its slot.
+ */
+static void
+timerwheel_unplace(timerwheel_t wheel, struct timer* timer)
+{
+	int level = (timer->slot - &wheel->slots[0][0]) / SLOTS;
+	int index = (timer->slot - &wheel->slots[0][0]) % SLOTS;
+
+	intrusive_queue_delete(timer->slot, &timer->link);
+	if (intrusive_queue_length(timer->slot) == 0)
+		wheel->occupied[level] &= ~(1ull << index);
+	timer->slot = NULL;
+}
+
+/*
+ * Return a timer to the free list, retiring its id.
+ */
+static void
+timerwheel_recycle(timerwheel_t wheel, struct timer* timer)
+{
+	if (++timer->generation == 0)
+		timer->generation = 1;
+	intrusive_queue_append(&wheel->freeTimers, &timer->link);
+}
+
+/*
+ * Move the timers of the slot at level the wheel's time has entered down
+ * to the lower levels. Return the slot's index.
+ */
+static int
+timerwheel_cascade(timerwheel_t wheel, int level)
+{
+	int index = timerwheel_slot_index(wheel->now, level);
+	struct timer* timer;
+
+	//The slot's range starts now, so its timers all land on lower levels
+	while (intrusive_queue_length(&wheel->slots[level][index]) > 0)
+	{
+		timer = queue_entry(wheel->slots[level][index].front, struct timer, link);
+		timerwheel_unplace(wheel, timer);
+		timerwheel_place(wheel, timer);
+	}
+
+	return index;
+}
+
+
+//REQUIRED FUNCTIONS
+timerwheel_t
+timerwheel_new(long now)
+{
+	timerwheel_t wheel = (timerwheel_t) malloc(sizeof(struct timerwheel));
+	int level;
+	int index;
+
+	if (wheel == NULL)
+		return NULL;
+
+	for (level = 0; level < TIMERWHEEL_LEVELS; level++)
+	{
+		for (index = 0; index < SLOTS; index++)
+			intrusive_queue_init(&wheel->slots[level][index]);
+		wheel->occupied[level] = 0;
+	}
+	wheel->now = now;
+	wheel->size = 0;
+	wheel->chunks = NULL;
+	wheel->chunkCount = 0;
+	intrusive_queue_init(&wheel->freeTimers);
+	wheel->firing = NULL;
+
+	return wheel;
+}
+
+timer_id_t
+timerwheel_add(timerwheel_t wheel, long deadline, void (*func)(void*), void* arg)
+{
+	return timerwheel_add_periodic(wheel, deadline, 0, func, arg);
+}
+
+timer_id_t
+timerwheel_add_periodic(timerwheel_t wheel, long deadline, long period,
+	void (*func)(void*), void* arg)
+{
+	struct timer** chunks;
+	struct timer* timer;
+	queue_link_t link;
+	int i;
+
+	if (wheel == NULL || func == NULL || period < 0)
+		return NULL;
+
+	//Allocate another chunk of timers if none are free
+	if (intrusive_queue_length(&wheel->freeTimers) == 0)
+	{
+		chunks = (struct timer**) realloc(wheel->chunks, sizeof(struct timer*) * (wheel->chunkCount + 1));
+		if (chunks == NULL)
+			return NULL;
+		wheel->chunks = chunks;
+		timer = (struct timer*) malloc(sizeof(struct timer) * CHUNK_SIZE);
+		if (timer == NULL)
+			return NULL;
+		wheel->chunks[wheel->chunkCount] = timer;
+		for (i = 0; i < CHUNK_SIZE; i++)
+		{
+			timer[i].generation = 1;
+			timer[i].index = wheel->chunkCount * CHUNK_SIZE + i;
+			timer[i].slot = NULL;
+			intrusive_queue_append(&wheel->freeTimers, &timer[i].link);
+		}
+		wheel->chunkCount++;
+	}
+
+	link = intrusive_queue_dequeue(&wheel->freeTimers);
+	timer = queue_entry(link, struct timer, link);
+
+	//Deadlines already passed fire at the next tick
+	if (deadline <= wheel->now)
+		deadline = wheel->now + 1;
+	timer->deadline = deadline;
+	timer->period = period;
+	timer->func = func;
+	timer->arg = arg;
+	timerwheel_place(wheel, timer);
+	wheel->size++;
+
+	return (timer_id_t) (((uintptr_t) timer->generation << 32) | timer->index);
+}
+
+int
+timerwheel_cancel(timerwheel_t wheel, timer_id_t id)
+{
+	unsigned int index = (unsigned int) (uintptr_t) id;
+	unsigned int generation = (unsigned int) ((uintptr_t) id >> 32);
+	struct timer* timer;
+
+	if (wheel == NULL || index >= (unsigned int) wheel->chunkCount * CHUNK_SIZE)
+		return 0;
+
+	timer = &wheel->chunks[index / CHUNK_SIZE][index % CHUNK_SIZE];
+	if (timer->generation != generation)
+		return 0;
+
+	//A periodic timer cancelling itself is simply not added again
+	if (timer == wheel->firing && timer->period > 0)
+	{
+		timer->period = 0;
+		return 1;
+	}
+	if (timer->slot == NULL)
+		return 0;
+
+	timerwheel_unplace(wheel, timer);
+	timerwheel_recycle(wheel, timer);
+	wheel->size--;
+	return 1;
+}
+
+void
+timerwheel_advance(timerwheel_t wheel, long now)
+{
+	struct timer* timer;
+	long next;
+	int index;
+	int level;
+
+	if (wheel == NULL)
+		return;
+
+	while (wheel->now < now)
+	{
+		//Nothing is cascaded or fired before next, so skip straight to it
+		next = timerwheel_next(wheel);
+		if (next == -1 || next > now)
+		{
+			wheel->now = now;
+			break;
+		}
+		wheel->now = next > wheel->now ? next : wheel->now + 1;
+
+		//Entering a new level 0 rotation cascades the next slot of level 1,
+		//and so on up while the higher levels roll over as well
+		index = timerwheel_slot_index(wheel->now, 0);
+		for (level = 1; index == 0 && level < TIMERWHEEL_LEVELS; level++)
+			index = timerwheel_cascade(wheel, level);
+
+		//Timers added by the functions fired are due at the next tick at
+		//the earliest, so they never land in the slot being fired
+		index = timerwheel_slot_index(wheel->now, 0);
+		while (intrusive_queue_length(&wheel->slots[0][index]) > 0)
+		{
+			timer = queue_entry(wheel->slots[0][index].front, struct timer, link);
+			timerwheel_unplace(wheel, timer);
+			//Waiting at the end of the span, not due yet
+			if (timer->deadline > wheel->now)
+			{
+				timerwheel_place(wheel, timer);
+				continue;
+			}
+			wheel->size--;
+			wheel->firing = timer;
+			timer->func(timer->arg);
+			wheel->firing = NULL;
+			if (timer->period > 0)
+			{
+				timer->deadline += timer->period;
+				if (timer->deadline <= wheel->now)
+					timer->deadline = wheel->now + 1;
+				timerwheel_place(wheel, timer);
+				wheel->size++;
+				continue;
+			}
+			//Recycled only now, so the function cannot cancel a new timer
+			//through its own id
+			timerwheel_recycle(wheel, timer);
+		}
+	}
+}
+
+long
+timerwheel_next(timerwheel_t wheel)
+{
+	long next = -1;
+	long start;
+	uint64_t rotated;
+	int level;
+	int current;
+	int offset;
+
+	if (wheel == NULL || wheel->size == 0)
+		return -1;
+
+	for (level = 0; level < TIMERWHEEL_LEVELS; level++)
+	{
+		if (wheel->occupied[level] == 0)
+			continue;
+
+		//Slots are searched from the one after the wheel's time onwards;
+		//on the higher levels the current slot itself comes last, a full
+		//rotation away
+		current = timerwheel_slot_index(wheel->now, level);
+		rotated = (wheel->occupied[level] >> current) | (wheel->occupied[level] << ((SLOTS - current) & SLOT_MASK));
+		rotated &= ~1ull;
+		offset = rotated != 0 ? __builtin_ctzll(rotated) : SLOTS;
+
+		//The first tick of the slot's range, when it is fired or cascaded
+		start = ((wheel->now >> (TIMERWHEEL_SLOT_BITS * level)) + offset) << (TIMERWHEEL_SLOT_BITS * level);
+		if (next == -1 || start < next)
+			next = start;
+	}
+
+	return next;
+}
+
+int
+timerwheel_length(timerwheel_t wheel)
+{
+	return wheel == NULL ? -1 : wheel->size;
+}
@@ -0,0 +1,83 @@
+/*
+ * Hierarchical timing wheel
+ */
+#ifndef __TIMERWHEEL_H__
+#define __TIMERWHEEL_H__
+
+/*
+ * A timing wheel holds timers, each of which calls a function once the
+ * wheel's time reaches the timer's deadline. Time is counted in ticks.
+ * Adding and cancelling a timer are O(1); advancing the wheel is O(1) per
+ * tick plus the timers that fire, with each timer moved down the wheel's
+ * levels at most TIMERWHEEL_LEVELS - 1 times before it fires.
+ *
+ * timerwheel_t is a pointer to an internally maintained data structure.
+ * Clients of this package do not need to know how timing wheels are
+ * represented. They see and manipulate only timerwheel_t's.
+ */
+typedef struct timerwheel* timerwheel_t;
+
+/*
+ * Identifies a timer added to a timing wheel. Never NULL. A timer's id
+ * stays distinct from the ids of timers added after it has fired or been
+ * cancelled, so a stale id can safely be cancelled.
+ */
+typedef void* timer_id_t;
+
+/*
+ * Each level has 2^TIMERWHEEL_SLOT_BITS slots, each covering
+ * 2^(TIMERWHEEL_SLOT_BITS * level) ticks, so the wheel spans
+ * 2^(TIMERWHEEL_SLOT_BITS * TIMERWHEEL_LEVELS) ticks. A timer further out
+ * than that waits at the end of the span and is placed again from there.
+ */
+#define TIMERWHEEL_LEVELS 4
+#define TIMERWHEEL_SLOT_BITS 6
+
+/*
+ * Return an empty timing wheel whose time is now. Returns NULL on error.
+ */
+extern timerwheel_t timerwheel_new(long now);
+
+/*
+ * Add a timer that calls func(arg) when the wheel's time reaches deadline,
+ * or at the next tick if deadline has already passed. Return its id, or
+ * NULL on error.
+ */
+extern timer_id_t timerwheel_add(timerwheel_t wheel, long deadline, void (*func)(void*), void* arg);
+
+/*
+ * Like timerwheel_add, but after firing the timer is added again period
+ * ticks after its deadline, keeping its id, until it is cancelled.
+ */
+extern timer_id_t timerwheel_add_periodic(timerwheel_t wheel, long deadline, long period,
+	void (*func)(void*), void* arg);
+
+/*
+ * Cancel the timer id. Return 1 if it was cancelled, or 0 if it had
+ * already fired or been cancelled. A periodic timer can be cancelled from
+ * its own function.
+ */
+extern int timerwheel_cancel(timerwheel_t wheel, timer_id_t id);
+
+/*
+ * Advance the wheel's time to now, firing every timer whose deadline is
+ * now or earlier, in deadline order. A timer may add and cancel timers
+ * from its function. Stretches of time with nothing due are skipped over,
+ * so advancing costs O(1) per tick only around the deadlines themselves.
+ */
+extern void timerwheel_advance(timerwheel_t wheel, long now);
+
+/*
+ * Return a tick no later than the earliest deadline in the wheel, by which
+ * it must next be advanced, or -1 if the wheel is empty. The tick is exact
+ * for deadlines less than 2^TIMERWHEEL_SLOT_BITS ticks away; advancing the
+ * wheel to an earlier estimate brings the deadline closer.
+ */
+extern long timerwheel_next(timerwheel_t wheel);
+
+/*
+ * Return the number of timers in the wheel.
+ */
+extern int timerwheel_length(timerwheel_t wheel);
+
+#endif /*__TIMERWHEEL_H__*/
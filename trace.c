@@ -0,0 +1,129 @@
+/*
+ * Scheduler trace buffers and dumping
+ */
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TRACE_MAX_BUFFERS 64
+
+__thread struct trace_buffer *trace_local = NULL;
+
+static struct trace_buffer *buffers[TRACE_MAX_BUFFERS];
+static int bufferCount = 0;
+
+//Timestamp counter and CLOCK_MONOTONIC when the first buffer was made
+static uint64_t cyclesBase;
+static uint64_t nanosBase;
+
+
+//Where to dump the trace at exit, from MINITHREAD_TRACE_FILE
+static char *exitPath = NULL;
+
+
+//HELPER FUNCTIONS
+static uint64_t
+trace_cycles()
+{
+	uint32_t low;
+	uint32_t high;
+
+	__asm__ volatile ("rdtsc" : "=a" (low), "=d" (high));
+	return ((uint64_t) high << 32) | low;
+}
+
+static uint64_t
+trace_nanos()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void
+trace_dump_at_exit()
+{
+	if (trace_dump(exitPath) != 0)
+		fprintf(stderr, "cannot write trace to %s\n", exitPath);
+}
+
+
+//REQUIRED FUNCTIONS
+void
+trace_thread_init()
+{
+	struct trace_buffer *buffer;
+	int id;
+
+	if (trace_local != NULL)
+		return;
+
+	id = __sync_fetch_and_add(&bufferCount, 1);
+	if (id >= TRACE_MAX_BUFFERS)
+		return;
+	if (id == 0)
+	{
+		cyclesBase = trace_cycles();
+		nanosBase = trace_nanos();
+		exitPath = getenv("MINITHREAD_TRACE_FILE");
+		if (exitPath != NULL)
+			atexit(trace_dump_at_exit);
+	}
+
+	buffer = (struct trace_buffer *) calloc(1, sizeof(struct trace_buffer));
+	if (buffer == NULL)
+		return;
+	buffer->id = id;
+	buffers[id] = buffer;
+	trace_local = buffer;
+}
+
+int
+trace_dump(char *path)
+{
+	struct trace_file_header header;
+	struct trace_buffer *buffer;
+	uint64_t first;
+	uint64_t last;
+	uint64_t i;
+	uint32_t count;
+	FILE *file;
+	int n = bufferCount < TRACE_MAX_BUFFERS ? bufferCount : TRACE_MAX_BUFFERS;
+	int b;
+
+	file = fopen(path, "wb");
+	if (file == NULL)
+		return -1;
+
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.buffers = 0;
+	for (b = 0; b < n; b++)
+		if (buffers[b] != NULL)
+			header.buffers++;
+	header.eventSize = sizeof(struct trace_event);
+	header.cycles = trace_cycles() - cyclesBase;
+	header.nanos = trace_nanos() - nanosBase;
+	fwrite(&header, sizeof(header), 1, file);
+
+	for (b = 0; b < n; b++)
+	{
+		buffer = buffers[b];
+		if (buffer == NULL)
+			continue;
+		//Only the newest TRACE_BUFFER_EVENTS are still there
+		last = buffer->next;
+		first = last > TRACE_BUFFER_EVENTS ? last - TRACE_BUFFER_EVENTS : 0;
+		count = last - first;
+		fwrite(&buffer->id, sizeof(buffer->id), 1, file);
+		fwrite(&count, sizeof(count), 1, file);
+		for (i = first; i < last; i++)
+			fwrite(&buffer->events[i & (TRACE_BUFFER_EVENTS - 1)], sizeof(struct trace_event), 1, file);
+	}
+
+	if (fclose(file) != 0)
+		return -1;
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Scheduler tracing
+ */
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * When built with -DMINITHREAD_TRACE, the scheduler records context
+ * switches, clock ticks, interrupts taken or dropped, and semaphore blocks
+ * and wakeups as they happen, into a ring buffer per host thread that keeps
+ * the last TRACE_BUFFER_EVENTS events. Recording an event takes a
+ * timestamp counter read and a few stores, with no locks or locked
+ * instructions. Without -DMINITHREAD_TRACE, TRACE compiles to nothing.
+ *
+ * trace_dump writes the buffers to a file, which trace2json turns into a
+ * Chrome trace (chrome://tracing, or ui.perfetto.dev). The buffers are
+ * dumped when the process exits if the environment variable
+ * MINITHREAD_TRACE_FILE names the file to write.
+ */
+
+enum {
+	TRACE_SWITCH = 1, //a: thread switched from, b: thread switched to
+	TRACE_TICK, //a: thread running, b: quanta counted
+	TRACE_INTERRUPT, //a: signal, b: 1 if taken, 0 if dropped
+	TRACE_BLOCK, //a: thread blocking, b: semaphore
+	TRACE_WAKE //a: thread woken, b: semaphore
+};
+
+struct trace_event {
+	uint64_t time; //timestamp counter, see minithread_cycles
+	uint32_t type;
+	uint32_t a;
+	uint64_t b;
+};
+
+#define TRACE_BUFFER_EVENTS (1 << 16) //must be a power of 2
+
+struct trace_buffer {
+	uint64_t next; //events ever recorded; the next goes at next % TRACE_BUFFER_EVENTS
+	uint32_t id; //the host thread's index, in the order buffers were made
+	struct trace_event events[TRACE_BUFFER_EVENTS];
+};
+
+/*
+ * A dump file is a trace_file_header, then for each buffer its id, the
+ * number of events that follow, and those events, oldest first.
+ */
+#define TRACE_MAGIC "MTTRACE1"
+
+struct trace_file_header {
+	char magic[8];
+	uint32_t buffers;
+	uint32_t eventSize;
+	//timestamp counter cycles and nanoseconds elapsed over the same
+	//stretch of time, to convert one to the other
+	uint64_t cycles;
+	uint64_t nanos;
+};
+
+/*
+ * The calling host thread's buffer, NULL until trace_thread_init.
+ */
+extern __thread struct trace_buffer *trace_local;
+
+/*
+ * Give the calling host thread a buffer. Called by each scheduler worker
+ * before it runs anything.
+ */
+extern void trace_thread_init();
+
+/*
+ * Write every host thread's buffer to the file at path. The buffers are
+ * not locked, so events recorded during the dump may or may not make it.
+ * Returns 0 on success, or -1 on error.
+ */
+extern int trace_dump(char *path);
+
+/*
+ * Record an event in the calling host thread's buffer, if it has one.
+ */
+static inline void
+trace_record(uint32_t type, uint32_t a, uint64_t b)
+{
+	struct trace_buffer *buffer = trace_local;
+	struct trace_event *event;
+	uint64_t slot = 1;
+	uint32_t low;
+	uint32_t high;
+
+	if (buffer == NULL)
+		return;
+
+	//A single instruction, so a signal handler on this host thread can
+	//not take the same slot; only this host thread writes the buffer
+	__asm__ volatile ("xaddq %0, %1" : "+r" (slot), "+m" (buffer->next));
+	event = &buffer->events[slot & (TRACE_BUFFER_EVENTS - 1)];
+
+	__asm__ volatile ("rdtsc" : "=a" (low), "=d" (high));
+	event->time = ((uint64_t) high << 32) | low;
+	event->type = type;
+	event->a = a;
+	event->b = b;
+}
+
+#ifdef MINITHREAD_TRACE
+#define TRACE(type, a, b) trace_record((type), (a), (uint64_t) (b))
+#define TRACE_THREAD_INIT() trace_thread_init()
+#else
+#define TRACE(type, a, b) ((void) 0)
+#define TRACE_THREAD_INIT() ((void) 0)
+#endif
+
+#endif /*__TRACE_H__*/
@@ -0,0 +1,157 @@
+/* trace2json.c
+
+   Converts a scheduler trace written by trace_dump into the Chrome trace
+   event format, to load into chrome://tracing or ui.perfetto.dev. Each
+   host thread is a track, showing which minithread it ran when as slices,
+   and ticks, interrupts and semaphore blocks and wakeups as instants.
+   Times are in microseconds from the earliest event in the trace.
+
+   This runs on the host, without the minithread system.
+
+   usage: trace2json trace-file [json-file]
+*/
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+FILE* out;
+int first = 1;
+double nanosPerCycle;
+uint64_t origin;
+
+double micros(uint64_t time) {
+  return (double) (time - origin) * nanosPerCycle / 1000;
+}
+
+/* start the next event in the array */
+void separate() {
+  fprintf(out, first ? "\n" : ",\n");
+  first = 0;
+}
+
+void slice(uint32_t tid, uint32_t thread, uint64_t from, uint64_t to) {
+  separate();
+  fprintf(out, "{\"name\":\"thread %u\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+      "\"ts\":%.3f,\"dur\":%.3f}", thread, tid, micros(from), micros(to) - micros(from));
+}
+
+void instant(uint32_t tid, struct trace_event* e) {
+  separate();
+  switch (e->type) {
+  case TRACE_TICK:
+    fprintf(out, "{\"name\":\"tick\",\"args\":{\"thread\":%u,\"quanta\":%llu}",
+        e->a, (unsigned long long) e->b);
+    break;
+  case TRACE_INTERRUPT:
+    fprintf(out, "{\"name\":\"%s\",\"args\":{\"signal\":%u}",
+        e->b ? "interrupt" : "interrupt dropped", e->a);
+    break;
+  case TRACE_BLOCK:
+  case TRACE_WAKE:
+    fprintf(out, "{\"name\":\"%s\",\"args\":{\"thread\":%u,\"semaphore\":\"0x%llx\"}",
+        e->type == TRACE_BLOCK ? "block" : "wake", e->a, (unsigned long long) e->b);
+    break;
+  default:
+    fprintf(out, "{\"name\":\"unknown %u\"", e->type);
+    break;
+  }
+  fprintf(out, ",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", tid, micros(e->time));
+}
+
+/* one host thread's events, oldest first */
+void convert(uint32_t tid, struct trace_event* events, uint32_t count) {
+  uint64_t since = 0;
+  uint32_t running = 0;
+  int known = 0;
+  uint32_t i;
+
+  separate();
+  fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+      "\"args\":{\"name\":\"worker %u\"}}", tid, tid);
+
+  for (i = 0; i < count; i++) {
+    if (events[i].type != TRACE_SWITCH) {
+      instant(tid, &events[i]);
+      continue;
+    }
+    /* the thread switched from ran since the last switch, or since the
+       oldest event if the buffer wrapped around before it */
+    slice(tid, events[i].a, known ? since : events[0].time, events[i].time);
+    running = (uint32_t) events[i].b;
+    since = events[i].time;
+    known = 1;
+  }
+  if (known && count > 0)
+    slice(tid, running, since, events[count - 1].time);
+}
+
+int
+main(int argc, char *argv[]) {
+  struct trace_file_header header;
+  struct trace_event** events;
+  uint32_t* ids;
+  uint32_t* counts;
+  FILE* in;
+  uint32_t b;
+
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s trace-file [json-file]\n", argv[0]);
+    return 1;
+  }
+  in = fopen(argv[1], "rb");
+  if (in == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.eventSize != sizeof(struct trace_event)) {
+    fprintf(stderr, "%s: not a trace file\n", argv[1]);
+    return 1;
+  }
+  nanosPerCycle = header.cycles > 0 ? (double) header.nanos / header.cycles : 1;
+
+  /* read everything first to find the earliest event */
+  events = (struct trace_event **) calloc(header.buffers, sizeof(struct trace_event *));
+  ids = (uint32_t *) calloc(header.buffers, sizeof(uint32_t));
+  counts = (uint32_t *) calloc(header.buffers, sizeof(uint32_t));
+  origin = UINT64_MAX;
+  for (b = 0; b < header.buffers; b++) {
+    if (fread(&ids[b], sizeof(uint32_t), 1, in) != 1 ||
+        fread(&counts[b], sizeof(uint32_t), 1, in) != 1) {
+      fprintf(stderr, "%s: truncated\n", argv[1]);
+      return 1;
+    }
+    events[b] = (struct trace_event *) malloc(sizeof(struct trace_event) * (counts[b] + 1));
+    if (fread(events[b], sizeof(struct trace_event), counts[b], in) != counts[b]) {
+      fprintf(stderr, "%s: truncated\n", argv[1]);
+      return 1;
+    }
+    if (counts[b] > 0 && events[b][0].time < origin)
+      origin = events[b][0].time;
+  }
+  fclose(in);
+
+  out = stdout;
+  if (argc == 3) {
+    out = fopen(argv[2], "w");
+    if (out == NULL) {
+      perror(argv[2]);
+      return 1;
+    }
+  }
+
+  fprintf(out, "{\"traceEvents\":[");
+  for (b = 0; b < header.buffers; b++)
+    convert(ids[b], events[b], counts[b]);
+  fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+  if (fclose(out) != 0) {
+    perror("close");
+    return 1;
+  }
+  return 0;
+}